@@ -4,17 +4,284 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <thread>
 #include <atomic>
+#include <sstream>
+#include <vector>
 
 #include "include/rapidjson/document.h"
 
 #include "src/web.h"
 #include "src/arbitrage.h"
+#include "src/options.h"
+#include "src/feed_handler.h"
+#include "src/shm_bus.h"
+#include "src/multicast.h"
+#include "src/binance.h"
+#include "src/simulated_exchange.h"
+#include "src/cross_arbitrage.h"
+#include "src/universe_scanner.h"
+
+// comma separated list, for example 'stream.binance.com:9443,stream.binance.com:443'
+static std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    for (std::string item; std::getline(stream, item, ',');) items.push_back(item);
+    return items;
+}
+
+// feed handler mode: books of many symbols are published to strategies on this host
+static int run_feed_handler(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cout << "===\n"
+                     "arb feed <rest api url> <symbols> [options]\n"
+                     "where:"
+                     "\t<rest api url>: url for binance server for book snapshots (for example: 'api.binance.com')\n"
+                     "\t<symbols>: comma separated symbols to publish (for example: 'BTCUSDT,ETHUSDT')\n"
+                     "options:\n"
+                     "\t--ws-endpoints=<host[:port],...>: market data endpoints, same as for strategy\n"
+                     "\t--shm=<name>: name of shared memory bus in /dev/shm (default: 'arb_md', not used with only --multicast)\n"
+                     "\t--multicast=<group:port>: also publish books as udp multicast to strategies on other hosts (for example: '239.1.1.1:30001')\n"
+                     "\t--multicast-interface=<ip>: local interface for multicast, '127.0.0.1' keeps it on this host (default: system route)\n"
+                     "\t--recovery-port=<port>: tcp port where subscribers ask for missed multicast datagrams and snapshots (default: multicast port + 1)\n"
+                     "\t--streams-per-connection=<count>: most streams on one websocket connection, more connections are opened as needed (default: '1024')\n"
+                     "\t--scan=<count>: also publish this many symbols picked by universe scanner from all market tickers, <symbols> may be '-' for none\n"
+                     "\t--scan-quote=<asset>: scanner only ranks symbols quoted in this asset (default: 'USDT')\n"
+                     "\t--scan-min-volume=<amount>: smallest 24h quote volume of a candidate (default: '1000000')\n"
+                     "\t--scan-fee=<fraction>: taker fee, spread plus two fees is the cost volatility is compared with (default: '0.001')\n"
+                     "\t--scan-window=<seconds>: averaging window of volatility and spread (default: '300')\n"
+                     "while running: type and enter\n"
+                     "\t'stats': print counters and scanner candidates\n"
+                     "\t'add <symbol>' / 'remove <symbol>': start or stop publishing symbol\n"
+                     "\t'rebalance': spread streams evenly over connections\n"
+                     "\t'list': print streams exchange has on every connection\n"
+                     "\tempty line quits\n"
+                     "===\n" << std::endl;
+        throw std::runtime_error("Invalid argument count!");
+    }
+    char** args = argv + 2;
+    std::string rest_api_host = *args++;
+    std::string symbol_list = *args++;
+    std::vector<std::string> symbols = symbol_list == "-" ? std::vector<std::string>{} : split_list(symbol_list);
+    Options options(argc - 4, args, {
+        {"ws-endpoints", OptionKind::value}, {"shm", OptionKind::value}, {"multicast", OptionKind::value}, {"multicast-interface", OptionKind::value},
+        {"recovery-port", OptionKind::value}, {"streams-per-connection", OptionKind::value}, {"scan", OptionKind::value}, {"scan-quote", OptionKind::value},
+        {"scan-min-volume", OptionKind::value}, {"scan-fee", OptionKind::value}, {"scan-window", OptionKind::value},
+    });
+
+    try {
+        auto io = net::io_context{};
+        auto ssl = net::ssl::context{net::ssl::context::tlsv12_client};
+        std::vector<std::string> ws_hosts = split_list(options.get_string("ws-endpoints", "stream.binance.com"));
+        FeedHandler handler(symbols, rest_api_host, ws_hosts, io, ssl, static_cast<size_t>(options.get_int("streams-per-connection", FeedSupervisor::max_streams)));
+        std::unique_ptr<ShmPublisher> bus;
+        if (options.has("shm") || !options.has("multicast")) {
+            bus = std::make_unique<ShmPublisher>(options.get_string("shm", "arb_md"));
+            handler.add_sink([&](const BookSnapshot& s) { bus->publish(s); });
+            std::cout << "publishing to /dev/shm" << bus->get_name() << std::endl;
+        }
+        std::unique_ptr<MulticastPublisher> multicast;
+        if (options.has("multicast")) {
+            auto [group, port] = multicast_wire::split_host_port(options.get_string("multicast"));
+            auto recovery_port = static_cast<uint16_t>(options.get_int("recovery-port", port + 1));
+            multicast = std::make_unique<MulticastPublisher>(io, group, port, recovery_port, options.get_string("multicast-interface"));
+            handler.add_sink([&](const BookSnapshot& s) { multicast->publish(s); });
+            multicast->start();
+            std::cout << "publishing to " << group << ":" << port << ", recovery on port " << recovery_port << std::endl;
+        }
+        std::unique_ptr<UniverseScanner> scanner;
+        if (options.has("scan")) {
+            scanner = std::make_unique<UniverseScanner>(io, ssl, ws_hosts.front(), static_cast<size_t>(options.get_int("scan")), options.get_string("scan-quote", "USDT"),
+                                                        options.get_double("scan-min-volume", 1000000), options.get_double("scan-fee", 0.001), options.get_int("scan-window", 300),
+                                                        [&](const std::vector<UniverseScanner::Candidate>& candidates) {
+                std::vector<std::string> top;
+                for (auto& c : candidates) top.push_back(c.symbol);
+                handler.set_universe(top);
+            });
+            scanner->start();
+        }
+
+        std::thread loop_ctrl_thread([&]() {
+            for (std::string line; std::getline(std::cin, line) && !line.empty();) {
+                std::istringstream command(line);
+                std::string name, symbol;
+                command >> name >> symbol;
+                net::post(io, [&, name, symbol]() {
+                    if (name == "stats") {
+                        handler.print_stats();
+                        if (multicast) std::cout << "multicast: sequence " << multicast->get_sequence() << ", send errors " << multicast->get_send_errors() << std::endl;
+                        if (scanner) scanner->print_stats();
+                    }
+                    else if (name == "add") std::cout << (handler.add_symbol(symbol) ? "added " : "not added ") << symbol << std::endl;
+                    else if (name == "remove") std::cout << (handler.remove_symbol(symbol) ? "removed " : "not published ") << symbol << std::endl;
+                    else if (name == "rebalance") handler.rebalance();
+                    else if (name == "list") handler.print_subscriptions();
+                    else std::cout << "unknown command '" << name << "'" << std::endl;
+                });
+            }
+            net::post(io, [&]() {
+                handler.close();
+                if (multicast) multicast->close();
+                if (scanner) scanner->close();
+            });
+        });
+
+        handler.start();
+        try { io.run(); }
+        catch (...) {
+            loop_ctrl_thread.detach();
+            if (bus) bus->unlink();
+            throw;
+        }
+        loop_ctrl_thread.join();
+        if (bus) bus->unlink();
+    }
+    catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+
+    std::cout << "exit" << std::endl;
+    return 0;
+}
+
+// cross venue mode: one instrument on two binance api compatible venues
+template<class Venue>
+static void run_cross(std::array<std::unique_ptr<Venue>, 2>& venues, const std::array<CrossVenueConfig, 2>& configs, double quantity, double min_edge, const Options& options, net::ssl::context& ssl) {
+    std::ofstream log_file("log.json");
+    log_file << "[   \n\t";
+    {
+        CrossArbitrage<Venue, Venue> cross(configs, ssl, quantity, min_edge, std::chrono::milliseconds(options.get_int("cooldown", 1000)), log_file, *venues[0], *venues[1]);
+        cross.start();
+        std::cout << "started" << std::endl;
+        for (std::string line; std::getline(std::cin, line) && line == "stats";) cross.print_stats();
+        cross.close();
+    }
+    for (auto& v : venues) v->close();
+    log_file << "\n]";
+}
+
+static int run_cross_arbitrage(int argc, char* argv[]) {
+    if (argc < 6) {
+        std::cout << "===\n"
+                     "arb cross <quantity> <min edge> <venue> <venue> [options]\n"
+                     "where:"
+                     "\t<quantity>: most base asset to buy on one venue and sell on the other per cycle (for example: '0.01')\n"
+                     "\t<min edge>: smallest profit after taker fees, as a factor of cost (for example: '0.0005'; 0.0005 is 0.05%)\n"
+                     "\t<venue>: <rest api url>,<websocket host[:port]>,<symbol>,<taker fee> (for example: 'api.binance.com,stream.binance.com:9443,BTCUSDT,0.001')\n"
+                     "options:\n"
+                     "\t--keys=<key>:<secret>,<key>:<secret>: api keys of both venues, in venue order\n"
+                     "\t--simulate: fill orders locally against venue books, keys are not used\n"
+                     "\t--cooldown=<ms>: wait after a cycle before next one (default: '1000')\n"
+                     "while running: type 'stats' and enter to print counters and consolidated book, empty line quits\n"
+                     "===\n" << std::endl;
+        throw std::runtime_error("Invalid argument count!");
+    }
+    char** args = argv + 2;
+    double quantity = std::stod(*args++);
+    double min_edge = std::stod(*args++);
+    std::array<std::vector<std::string>, 2> venue_args{split_list(*args++), split_list(*args++)};
+    Options options(argc - 6, args, {{"keys", OptionKind::value}, {"simulate", OptionKind::flag}, {"cooldown", OptionKind::value}});
+
+    std::array<CrossVenueConfig, 2> configs;
+    for (size_t i = 0; i < 2; ++i) {
+        if (venue_args[i].size() != 4) throw std::runtime_error("Venue must be <rest api url>,<websocket host>,<symbol>,<taker fee>");
+        configs[i] = {venue_args[i][2], {venue_args[i][1]}, std::stod(venue_args[i][3])};
+    }
+    std::vector<std::string> keys = split_list(options.get_string("keys"));
+
+    try {
+        auto io = net::io_context{};
+        auto ssl = net::ssl::context{net::ssl::context::tlsv12_client};
+        if (options.has("simulate")) {
+            std::array<std::unique_ptr<SimulatedExchange<BinanceExchange>>, 2> venues;
+            for (size_t i = 0; i < 2; ++i) venues[i] = std::make_unique<SimulatedExchange<BinanceExchange>>(venue_args[i][0], venue_args[i][1], "", "", io, ssl);
+            run_cross(venues, configs, quantity, min_edge, options, ssl);
+        }
+        else {
+            if (keys.size() != 2) throw std::runtime_error("Both venues need --keys, or use --simulate");
+            std::array<std::unique_ptr<BinanceExchange>, 2> venues;
+            for (size_t i = 0; i < 2; ++i) {
+                size_t colon = keys[i].find(':');
+                if (colon == std::string::npos) throw std::runtime_error("Key must be <key>:<secret>");
+                venues[i] = std::make_unique<BinanceExchange>(venue_args[i][0], venue_args[i][1], keys[i].substr(0, colon), keys[i].substr(colon + 1), io, ssl);
+            }
+            run_cross(venues, configs, quantity, min_edge, options, ssl);
+        }
+    }
+    catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+
+    std::cout << "exit" << std::endl;
+    return 0;
+}
+
+// runs strategy on io until quit, venue is closed right after strategy
+template<class Venue>
+static void run_strategy(Venue& exchange, const std::string& symbol, const std::vector<std::string>& ws_hosts, double start_amount, int buy_delay, int max_sell_delay, double activation_threshold, std::ofstream& log_file, const Options& options, const RiskLimits& limits, const std::string& trace_file, net::io_context& io, net::ssl::context& ssl) {
+    Arbitrage<Venue> arb(exchange, symbol, ws_hosts, start_amount, io, ssl, true, buy_delay, max_sell_delay, activation_threshold, log_file, options.get_int("max-positions", 1), options.has("rx-timestamps"));
+
+    // 'stats' prints latency histograms, any other line quits
+    // prometheus scrapes are served from the same io
+    std::unique_ptr<MetricsServer> metrics;
+    if (options.get_int("metrics-port") > 0)
+        metrics = std::make_unique<MetricsServer>(io, options.get_string("metrics-address", "127.0.0.1"), static_cast<uint16_t>(options.get_int("metrics-port")), [&]() { return arb.render_metrics(); });
+
+    // SIGUSR1 writes trace file without stopping, file is written off the io thread
+    net::signal_set trace_signals(io);
+    std::function<void()> wait_trace_signal = [&]() {
+        trace_signals.async_wait([&](beast::error_code ec, int) {
+            if (ec) return;
+            Tracer::dump_async(trace_file, [&trace_file](bool ok) {
+                std::cout << (ok ? "trace written to " : "failed to write trace to ") << trace_file << std::endl;
+            });
+            wait_trace_signal();
+        });
+    };
+    if (!trace_file.empty()) {
+        trace_signals.add(SIGUSR1);
+        wait_trace_signal();
+    }
+
+    std::thread loop_ctrl_thread([&]() {
+        for (std::string line; std::getline(std::cin, line) && line == "stats";) arb.print_stats();
+        net::post(io, [&]() {
+            arb.close();
+            exchange.close();
+            if (metrics) metrics->close();
+            beast::error_code ignored;
+            trace_signals.cancel(ignored);
+        });
+    });
+
+    arb.set_conflate(options.has("conflate"));
+    arb.set_risk_limits(limits);
+    if (options.has("trades")) arb.set_trade_stream(options.get_string("trades") != "raw");
+    if (options.has("adaptive-threshold"))
+        arb.set_adaptive_threshold(options.get_double("adaptive-threshold"), options.get_double("threshold-min", activation_threshold / 4), options.get_double("threshold-max", activation_threshold * 4), options.has("threshold-compare"));
+    if (options.has("shm")) arb.set_book_bus(options.get_string("shm"));
+    if (options.has("multicast")) {
+        auto [group, port] = multicast_wire::split_host_port(options.get_string("multicast"));
+        auto [recovery_host, recovery_port] = multicast_wire::split_host_port(options.get_string("recovery", "127.0.0.1:" + std::to_string(port + 1)));
+        arb.set_book_multicast(group, port, recovery_host, recovery_port, options.get_string("multicast-interface"));
+    }
+
+    std::cout << "connected" << std::endl;
+    arb.start();
+    if (metrics) metrics->start();
+    try { io.run(); }
+    catch (...) {
+        loop_ctrl_thread.detach();
+        throw;
+    }
+    loop_ctrl_thread.join();
+}
 
 int main(int argc, char* argv[]) {
     std::cout << "found " << argc << " args" << std::endl;
-    if (argc != 9) {
+    if (argc > 1 && std::string(argv[1]) == "feed") return run_feed_handler(argc, argv);
+    if (argc > 1 && std::string(argv[1]) == "cross") return run_cross_arbitrage(argc, argv);
+    if (argc < 9) {
         std::cout << "===\n"
-                     "arb <rest api url> <key> <secret> <symbol> <start amount> <buy delay> <max sell delay> <activation threshold>\n"
+                     "arb <rest api url> <key> <secret> <symbol> <start amount> <buy delay> <max sell delay> <activation threshold> [options]\n"
                      "where:"
                      "\t<rest api url>: url for binance server for orders ('testnet.binance.vision' for testnet and 'https://api.binance.com' for real)\n"
                      "\t<key>: key for api with orders permission (for example: 'QBSsOhuQhdforTQXPASGOWlfNUPP0WL2d14YN525JRRqjzIfVTL1D7Jdqx0Ki2cH')\n"
@@ -24,6 +291,30 @@ int main(int argc, char* argv[]) {
                      "\t<buy delay>: delay in seconds between selling and buying crypto (for example: '30')\n"
                      "\t<max sell delay>: maximum delay in seconds after which crypto will be sold (for example: '60')\n"
                      "\t<activation threshold>: how sensitive this script to price change, in 'factor' (for example: '0.0001'; 0.0001 is 0.01%)\n"
+                     "options:\n"
+                     "\t--recv-window=<ms>: how long signed request stays valid on exchange, timestamps are synced with exchange so it can be tight (for example: '1000')\n"
+                     "\t--ws-endpoints=<host[:port],...>: market data endpoints, each one gets its own connection and first copy of every update is used (for example: 'stream.binance.com:9443,stream.binance.com:443')\n"
+                     "\t--max-positions=<count>: how many positions can be held at once, new one is opened after buy delay (default: '1')\n"
+                     "\t--rx-timestamps: take receive time of market data and order responses from kernel (linux SO_TIMESTAMPING), so time in kernel, tls and parsing shows up separately in stats\n"
+                     "\t--perf-counters: count cycles, instructions, cache and branch misses of hot path regions (linux perf_event_open), shown with stats\n"
+                     "\t--metrics-port=<port>: serve prometheus metrics over http on this port (for example: '9100')\n"
+                     "\t--metrics-address=<ip>: address for metrics listener (default: '127.0.0.1')\n"
+                     "\t--shm=<name>: take books from feed handler ('arb feed') over shared memory bus instead of own websockets (for example: 'arb_md')\n"
+                     "\t--multicast=<group:port>: take books from feed handler over udp multicast instead of own websockets (for example: '239.1.1.1:30001')\n"
+                     "\t--multicast-interface=<ip>: local interface to join multicast group on (default: system route)\n"
+                     "\t--recovery=<host:port>: feed handler recovery port for missed multicast datagrams (default: multicast port + 1 on localhost)\n"
+                     "\t--trace=<file>: record hot path timeline and write it as chrome trace json on SIGUSR1 and on exit (for example: 'trace.json')\n"
+                     "\t--simulate: paper trading, market data and symbols come from binance but market orders are filled locally against the book, key and secret are not used\n"
+                     "\t--conflate: when strategy falls behind, apply all queued book updates at once and evaluate strategy only on the newest book\n"
+                     "\t--adaptive-threshold=<multiplier>: activation threshold follows realized volatility of price changes, multiplier times its standard deviation (for example: '3')\n"
+                     "\t--threshold-min=<factor>, --threshold-max=<factor>: bounds of adaptive threshold (default: activation threshold / 4 and * 4)\n"
+                     "\t--max-notional=<amount>: largest order in currency, bigger ones are not sent (default: no limit)\n"
+                     "\t--max-position=<amount>: most crypto held after a buy fills (default: no limit)\n"
+                     "\t--price-band=<factor>: no order when top of the book is further than this from average mid price (for example: '0.01'; default: no limit)\n"
+                     "\t--max-order-rate=<count>: most orders per second, bursts up to the same count (default: no limit)\n"
+                     "\t--trades[=raw]: also take aggregate trades (every single trade with 'raw') for trade signals and 1s/1m/5m bars, minute bars are written to the log\n"
+                     "\t--threshold-compare: keep trading on fixed activation threshold and only count what adaptive one would do, shown with stats\n"
+                     "while running: type 'stats' and enter to print latency histograms, empty line quits\n"
                      "Note: all parameters are without quotation marks (<\'> or <\">)\n"
                      "===\n"
                      "Example:\n"
@@ -36,36 +327,66 @@ int main(int argc, char* argv[]) {
     std::string api_key = *args++;
     std::string api_secret = *args++;
     std::string ws_host = "stream.binance.com";
+    // user data stream is bound to the exchange that issued listen key
+    std::string user_ws_host = rest_api_host == "testnet.binance.vision" ? rest_api_host : ws_host;
     std::string symbol = *args++;
     double start_amount = std::stod(*args++);
     int buy_delay = std::stoi(*args++);
     int max_sell_delay = std::stoi(*args++);
     double activation_threshold = std::stod(*args++);
+    Options options(argc - 9, args, {
+        {"recv-window", OptionKind::value}, {"ws-endpoints", OptionKind::value}, {"max-positions", OptionKind::value}, {"rx-timestamps", OptionKind::flag},
+        {"perf-counters", OptionKind::flag}, {"metrics-port", OptionKind::value}, {"metrics-address", OptionKind::value}, {"shm", OptionKind::value},
+        {"multicast", OptionKind::value}, {"multicast-interface", OptionKind::value}, {"recovery", OptionKind::value}, {"trace", OptionKind::value},
+        {"simulate", OptionKind::flag}, {"conflate", OptionKind::flag}, {"adaptive-threshold", OptionKind::value}, {"threshold-min", OptionKind::value},
+        {"threshold-max", OptionKind::value}, {"max-notional", OptionKind::value}, {"max-position", OptionKind::value}, {"price-band", OptionKind::value},
+        {"max-order-rate", OptionKind::value}, {"trades", OptionKind::optional_value}, {"threshold-compare", OptionKind::flag},
+    });
+
+    // checked before anything connects, a limit that doesn't parse must not leave trading unlimited
+    RiskLimits limits;
+    auto risk_limit = [&](const char* name, double& limit) {
+        if (!options.has(name)) return;
+        limit = options.get_double(name);
+        if (!(limit > 0)) throw std::runtime_error(std::string("Option '--") + name + "' must be a positive number");
+    };
+    risk_limit("max-notional", limits.max_notional);
+    risk_limit("max-position", limits.max_position);
+    risk_limit("price-band", limits.price_band);
+    risk_limit("max-order-rate", limits.max_order_rate);
+
+    // every endpoint gets its own connection to the same streams, none when books come from feed handler
+    std::vector<std::string> ws_hosts = split_list(options.get_string("ws-endpoints", ws_host));
+    if (options.has("shm") || options.has("multicast")) ws_hosts.clear();
 
     std::ofstream log_file("log.json");
     log_file.clear();
     log_file << "[   \n\t";
 
+    if (options.has("perf-counters") && !PerfCounters::enable())
+        std::cout << "hardware performance counters are not available" << std::endl;
+
+    // spans are recorded from the start, so file gets constructor requests too
+    std::string trace_file = options.get_string("trace");
+    if (!trace_file.empty()) Tracer::enable();
+
     try {
         auto io = net::io_context{};
         auto ssl = net::ssl::context{net::ssl::context::tlsv12_client};
-        Arbitrage arb(symbol, rest_api_host, ws_host, api_key, api_secret, start_amount, io, ssl, true, buy_delay, max_sell_delay, activation_threshold, log_file);
-
-        std::atomic<bool> quit = false;
-        std::thread loop_ctrl_thread([&]() {
-            getchar();
-            quit = true;
-        });
-
-        std::cout << "connected" << std::endl;
-        while (!quit) arb.update();
-        loop_ctrl_thread.join();
-        arb.close();
+        if (options.has("simulate")) {
+            SimulatedExchange<BinanceExchange> exchange(rest_api_host, user_ws_host, "", "", io, ssl);
+            run_strategy(exchange, symbol, ws_hosts, start_amount, buy_delay, max_sell_delay, activation_threshold, log_file, options, limits, trace_file, io, ssl);
+        }
+        else {
+            BinanceExchange exchange(rest_api_host, user_ws_host, api_key, api_secret, io, ssl, options.get_int("recv-window"), options.has("rx-timestamps"));
+            run_strategy(exchange, symbol, ws_hosts, start_amount, buy_delay, max_sell_delay, activation_threshold, log_file, options, limits, trace_file, io, ssl);
+        }
     }
     catch (std::exception& e) {
         std::cout << e.what() << std::endl;
     }
 
+    if (!trace_file.empty()) std::cout << (Tracer::dump(trace_file) ? "trace written to " : "failed to write trace to ") << trace_file << std::endl;
     std::cout << "exit" << std::endl;
     log_file << "\n]";
     log_file.close();
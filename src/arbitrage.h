@@ -5,6 +5,24 @@
 #include "../include/rapidjson/document.h"
 #include <chrono>
 #include "web.h"
+#include "timer_wheel.h"
+#include "positions.h"
+#include "order_book.h"
+#include "feed_supervisor.h"
+#include "feed_arbiter.h"
+#include "telemetry.h"
+#include "perf_counters.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "shm_bus.h"
+#include "multicast.h"
+#include "exchange.h"
+#include "signals.h"
+#include "bars.h"
+#include "risk.h"
+#include <memory>
+#include <thread>
+#include <mutex>
 #include <unordered_map>
 #include <iostream>
 #include <fstream>
@@ -16,6 +34,8 @@ public:
     double buy_amount;
     double sell_price;
     double sell_amount;
+    size_t buy_depth;  // index of deepest ask used, past the end if book was not enough
+    size_t sell_depth; // same for bids
 
     friend std::ostream& operator<<(std::ostream& os, const DepthData& r) {
         os << "BinanceResult { "
@@ -28,15 +48,17 @@ public:
     }
 };
 
-DepthData parse_depth_data(rapidjson::Document& doc, double amount) {
+DepthData parse_depth_data(const OrderBook& book, double amount) {
+    TraceScope trace("parse_depth_data");
     double buy_price = 0;
     double sell_price = 0;
 
     double buy_amount = 0;
-    const rapidjson::Value& asks_json = doc["a"];
-    for (rapidjson::SizeType j = 0; j < asks_json.Size(); ++j) {
-        double p = std::stod(asks_json[j][0].GetString());
-        double a = std::stod(asks_json[j][1].GetString());
+    const std::vector<BookLevel>& asks = book.get_asks();
+    size_t buy_depth = 0;
+    for (; buy_depth < asks.size(); ++buy_depth) {
+        double p = asks[buy_depth].price;
+        double a = asks[buy_depth].quantity;
 
         double add = std::min(amount - buy_amount, 1/a);
         buy_amount += add;
@@ -45,10 +67,11 @@ DepthData parse_depth_data(rapidjson::Document& doc, double amount) {
     }
 
     double sell_amount = 0;
-    const rapidjson::Value& bids_json = doc["b"];
-    for (rapidjson::SizeType j = 0; j < bids_json.Size(); ++j) {
-        double p = std::stod(bids_json[j][0].GetString());
-        double a = std::stod(bids_json[j][1].GetString());
+    const std::vector<BookLevel>& bids = book.get_bids();
+    size_t sell_depth = 0;
+    for (; sell_depth < bids.size(); ++sell_depth) {
+        double p = bids[sell_depth].price;
+        double a = bids[sell_depth].quantity;
 
         double add = std::min(amount - sell_amount, 1/a);
         sell_amount += add;
@@ -56,157 +79,528 @@ DepthData parse_depth_data(rapidjson::Document& doc, double amount) {
         if (amount - sell_amount <= 0) break;
     }
 
-    return DepthData{buy_price, buy_amount, sell_price, sell_amount};
+    return DepthData{buy_price, buy_amount, sell_price, sell_amount, buy_depth, sell_depth};
 }
 
+// strategy over any venue adapter (see exchange.h), adapter calls are resolved at compile time
+template<class Venue>
 class Arbitrage {
 private:
+    static constexpr std::chrono::milliseconds timer_resolution{10};
+    static constexpr std::chrono::seconds exit_retry_delay{1};
+    static constexpr std::chrono::seconds entry_retry_delay{1}; // shortest wait after an entry that bought nothing
+    static constexpr size_t position_capacity = 256;
+    static constexpr size_t threshold_window = 256; // sell price changes behind adaptive threshold
+
     uint64_t iterations{};
     int buy_delay;
     int sell_delay;
-    double activation_threshold;
+    AdaptiveThreshold<threshold_window> threshold;
+    bool threshold_compare{}; // fixed threshold trades, adaptive one only counts its triggers
     double previous_sell_price{};
     double current_sell_price{};
     bool useCurrencyForAmount;
-    double crypto_current_amount{};
     double crypto_buy_amount;
     std::string symbol;
-    std::chrono::time_point<std::chrono::steady_clock> crypto_buy_timestamp;
-    RestApi rest_api;
-    WebSockets web_sockets;
-    std::unordered_map<std::string, double> symbol_step_sizes;
+    bool entry_ready = true;
+    bool entry_blocked{}; // by a risk limit only position or limit change can clear
+    bool enough_liquidity{};
+    size_t max_positions;
+    net::io_context& io;
+    net::steady_timer tick_timer;
+    std::chrono::steady_clock::time_point start_time;
+    TimerWheel timers;
+    Timer entry_timer;
+    PositionManager<position_capacity, position_capacity * 2> positions;
+    Venue& exchange;
+    std::vector<std::string> ws_hosts;
+    // market data is read on its own thread, so pings are answered and sockets drained while strategy is busy
+    net::io_context feed_io;
+    std::thread feed_thread;
+    std::vector<std::unique_ptr<FeedSupervisor>> feeds; // same streams from every host, first copy of each update wins
+    FeedArbiter arbiter;
+    OrderBook book;
+    BookSync book_sync;
+    MarketSignals<> signals;
+    TradeBars bars;
+    RiskTable risk;
+    size_t risk_slot;
+    Telemetry telemetry;
+    // written on hot path, read by metrics scrape
+    ShardedCounter messages_received;
+    ShardedCounter messages_processed;
+    ShardedCounter orders_sent;
+    Gauge bid_levels;
+    Gauge ask_levels;
+    Gauge open_positions;
+    Gauge position_amount;
+    Gauge realized_pnl;
+    Gauge signal_microprice;
+    Gauge signal_imbalance;
+    Gauge signal_volatility;
+    Gauge signal_vwap;
+    Gauge signal_trade_flow;
+    ShardedCounter trades_processed;
+    // conflate mode: feed thread queues messages and posts one drain for the whole burst
+    struct PendingMessage {
+    public:
+        DepthUpdate update;
+        MessageTimes times;
+    };
+    bool conflate{};
+    std::mutex pending_mutex;
+    std::vector<PendingMessage> pending;
+    std::vector<PendingMessage> draining;
+    bool drain_posted{};
+    ShardedCounter messages_conflated;
+    // books from feed handler process instead of own websockets, always conflated to newest snapshot
+    std::unique_ptr<ShmSubscriber> bus;
+    std::unique_ptr<MulticastSubscriber> multicast; // same, but from feed handler on another host
+    std::atomic<bool> bus_stop{false};
+    BookSnapshot bus_snapshot{};
+    MessageTimes bus_times;
+    bool bus_posted{};
+    ShardedCounter evaluations_skipped;
+    // exit triggers of both thresholds while a position is held, counted when adaptive one is enabled
+    ShardedCounter fixed_triggers;
+    ShardedCounter adaptive_triggers;
+    Gauge adaptive_threshold;
+    bool closed{};
+    std::unordered_map<std::string, SymbolInfo> symbols;
     std::ofstream& log_file;
 private:
-    void update_exchange_info() {
-        auto result = rest_api.get("/api/v3/exchangeInfo", "", false);
-        rapidjson::Document doc;
-        doc.Parse(result.second.body().c_str());
-
-        symbol_step_sizes.clear();
-
-        auto symbols = doc["symbols"].GetArray();
-        for (rapidjson::SizeType i = 0; i < symbols.Size(); ++i) {
-            std::string s = symbols[i]["symbol"].GetString();
-            auto filters = symbols[i]["filters"].GetArray();
-            double step = 0;
-            for (rapidjson::SizeType j = 0; j < filters.Size(); ++j) {
-                if (strcmp(filters[j]["filterType"].GetString(), "LOT_SIZE") != 0) continue;
-                step = std::stod(filters[j]["stepSize"].GetString());
-                break;
+    // called on feed thread
+    void on_feed_message(size_t feed, rapidjson::Document& doc, MessageTimes& times) {
+        messages_received.add();
+        if (feeds.size() > 1) {
+            uint64_t first_id, final_id;
+            if (exchange.update_ids(doc, first_id, final_id)) {
+                const char* event = doc.HasMember("e") ? doc["e"].GetString() : "";
+                if (!arbiter.accept(feed, FeedArbiter::make_key(event, doc["s"].GetString()), first_id, final_id)) return;
+            }
+            // events without ids can't be arbitrated, take them from first live feed
+            else if (feed != first_connected_feed()) return;
+        }
+        record_feed_times(times);
+        // venue message becomes normalized diff here, so strategy thread never sees venue format
+        DepthUpdate depth;
+        if (!exchange.parse_depth(doc, depth)) {
+            Trade trade{};
+            if (exchange.parse_trade(doc, trade)) net::post(io, [this, trade]() { on_trade(trade); });
+            return;
+        }
+        if (!conflate) {
+            net::post(io, [this, depth = std::move(depth), times]() mutable { update(depth, times); });
+            return;
+        }
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        pending.push_back(PendingMessage{std::move(depth), times});
+        if (drain_posted) return;
+        drain_posted = true;
+        net::post(io, [this]() { drain(); });
+    }
+
+    // exchange clock is ahead of local one by time sync offset
+    void record_feed_times(const MessageTimes& times) {
+        if (times.kernel_rx_ns > 0) telemetry.kernel_to_user.record(times.local_rx_ns - times.kernel_rx_ns);
+        telemetry.parse_time.record(times.parsed_ns - times.local_rx_ns);
+        if (times.exchange_ms == 0) return;
+        int64_t rx_ns = times.kernel_rx_ns > 0 ? times.kernel_rx_ns : times.local_rx_ns;
+        int64_t exchange_ns = times.exchange_ms * 1000000;
+        telemetry.feed_latency.record(rx_ns - exchange_ns);
+        telemetry.one_way_delay.record(rx_ns + exchange.get_clock_offset_us() * 1000 - exchange_ns);
+    }
+
+    // called on feed thread, polls bus and sleeps on it when there is nothing new
+    void read_bus() {
+        BookSnapshot s;
+        while (!bus_stop.load(std::memory_order_relaxed)) {
+            if (!bus->next(s)) {
+                bus->wait(std::chrono::milliseconds(100));
+                continue;
             }
+            on_book_snapshot_received(s);
+        }
+    }
+
+    // called on feed thread for books from bus or multicast, strategy gets only the newest one
+    void on_book_snapshot_received(const BookSnapshot& s) {
+        if (!s.is_symbol(symbol)) return;
+
+        MessageTimes times;
+        times.local_rx_ns = times.parsed_ns = MessageTimes::now();
+        times.exchange_ms = s.exchange_ms;
+        messages_received.add();
+        telemetry.bus_delay.record(times.local_rx_ns - s.publish_ns);
+        record_feed_times(times);
+
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        bus_snapshot = s;
+        bus_times = times;
+        if (bus_posted) {
+            messages_conflated.add();
+            return;
+        }
+        bus_posted = true;
+        net::post(io, [this]() { on_bus_snapshot(); });
+    }
+
+    void on_bus_snapshot() {
+        BookSnapshot s;
+        MessageTimes times;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            s = bus_snapshot;
+            times = bus_times;
+            bus_posted = false;
+        }
+        if (closed) return;
+
+        TraceScope trace("update");
+        int64_t start_ns = MessageTimes::now();
+        telemetry.queue_time.record(start_ns - times.parsed_ns);
+        messages_processed.add();
+        {
+            PerfScope scope(perf_regions.strategy);
+            book.load_snapshot(s);
+            bid_levels.set(static_cast<double>(book.get_bids().size()));
+            ask_levels.set(static_cast<double>(book.get_asks().size()));
+            evaluate();
+        }
+        telemetry.process_time.record(MessageTimes::now() - start_ns);
+    }
 
-            symbol_step_sizes.emplace(s, step);
+    size_t first_connected_feed() const {
+        for (size_t i = 0; i < feeds.size(); ++i)
+            if (feeds[i]->is_connected()) return i;
+        return 0;
+    }
+
+    void print_feed_stats() const {
+        if (bus) std::cout << "bus " << bus->get_name() << ": received " << bus->get_received() << ", gaps " << bus->get_gaps() << std::endl;
+        if (multicast) std::cout << "multicast: received " << multicast->get_received() << ", gaps " << multicast->get_gaps() << ", recovered " << multicast->get_recovered() << std::endl;
+        for (size_t i = 0; i < feeds.size(); ++i) {
+            const auto& pings = feeds[i]->get_ping_stats();
+            uint64_t pongs = pings.pongs_received.load();
+            std::cout << "feed " << ws_hosts[i]
+                      << ": server pings " << pings.pings_received.load()
+                      << ", ping rtt " << (pongs > 0 ? pings.rtt_sum_ns.load() / static_cast<int64_t>(pongs) / 1000 : 0) << "us"
+                      << ", missed pongs " << pings.missed_pongs.load();
+            if (feeds.size() > 1) {
+                const auto& stats = arbiter.get_stats(i);
+                uint64_t wins = stats.wins.load();
+                std::cout << ", wins " << wins
+                          << ", duplicates " << stats.duplicates.load()
+                          << ", gaps " << stats.gaps.load()
+                          << ", avg lead " << (wins > 0 ? stats.lead_ns.load() / static_cast<int64_t>(wins) / 1000 : 0) << "us";
+            }
+            std::cout << std::endl;
         }
     }
 
+    void update_exchange_info() { exchange.load_symbols(symbols); }
+
     void subscribe_to_data() {
-        std::string symbol_lowercase = symbol;
-        std::transform(symbol_lowercase.begin(), symbol_lowercase.end(), symbol_lowercase.begin(), [](unsigned char c){ return std::tolower(c); } );
-        std::string ws_connection_msg =  "{"
-                                         "\"method\": \"SUBSCRIBE\","
-                                         "\"params\": [\"" + symbol_lowercase + "@depth@100ms\"],"
-                                         "\"id\": 0"
-                                         "}";
-
-        web_sockets.write(ws_connection_msg);
-        web_sockets.read();
-        rapidjson::Document doc;
-        doc.Parse(web_sockets.read_str_from_buffer().c_str());
-        if (!doc.HasMember("result"))
-            std::cout << BinanceResult{doc["code"].GetInt(), doc["msg"].GetString()} << std::endl;
+        for (auto& feed : feeds) feed->subscribe(exchange.depth_stream(symbol));
     }
 
     double fix_price(double v, bool useCurrency) {
-        double step = symbol_step_sizes[symbol];
+        double step = symbols[symbol].step_size;
         step = 1.0 / step;
 //        if (useCurrency) step = 1.0 / step;
         return floor(v * step) / step;
     }
 
-    std::string new_market_order(bool isBuy, double quantity, bool useQuoteOrderQty) {
-        std::string target = "/api/v3/order";
-        std::string query = "type=MARKET&symbol=" + symbol + "&side=" + (isBuy ? "BUY" : "SELL") + (useQuoteOrderQty ? "&quoteOrderQty=" : "&quantity=") + std::to_string(quantity);
-        auto result = rest_api.post(target, query, true);
-        return result.second.body();
+    // entries only, exits reduce exposure and are never blocked; expected price is top of the book,
+    // band is measured from ema of mid price; returns RiskReject bits
+    uint32_t check_entry_risk(double quantity, bool useQuoteOrderQty) {
+        int64_t now_ns = MessageTimes::now();
+        const std::vector<BookLevel>& asks = book.get_asks();
+        double price = asks.empty() ? 0 : asks.front().price;
+        double base = useQuoteOrderQty ? (price > 0 ? quantity / price : 0) : quantity;
+        uint32_t result = risk.check(risk_slot, true, base, price, signals.get_mid_ema(), now_ns);
+        risk.record_check_time(MessageTimes::now() - now_ns);
+        return result;
     }
 
-    static std::tuple<double, double, double> parse_market_order_result(rapidjson::Document& doc) {
-        //todo check error
-        double orig = std::stod(doc["origQty"].GetString());
-        double executed = std::stod(doc["executedQty"].GetString());
-        double cum = std::stod(doc["cummulativeQuoteQty"].GetString());
-        return {orig, executed, cum};
+    // entry held back by notional or position limit waits for position or limits to change
+    void release_entry_block() {
+        if (!entry_blocked) return;
+        entry_blocked = false;
+        entry_ready = true;
     }
 
-    void sell_crypto() {
-        double rounded_amount = fix_price(crypto_current_amount, !useCurrencyForAmount);
-        std::cout << "selling " << rounded_amount << std::endl;
-        std::string result_str = new_market_order(false, rounded_amount, !useCurrencyForAmount);
-        std::cout << result_str << std::endl;
-        log_file << result_str << ",\n\t";
+    // executed quantity comes later with order update, returns order id or -1 if order was rejected
+    int64_t new_market_order(bool isBuy, double quantity, bool useQuoteOrderQty) {
+        int64_t sent_ns = MessageTimes::now();
+        OrderAck ack = exchange.new_market_order(symbol, isBuy, quantity, useQuoteOrderQty);
+        if (!ack.sent) {
+            std::cout << "order skipped, rate limit reached" << std::endl;
+            return -1;
+        }
+        orders_sent.add();
+        telemetry.order_round_trip.record(std::chrono::duration_cast<std::chrono::nanoseconds>(ack.round_trip).count());
+        if (ack.response_rx_ns > 0) telemetry.order_kernel_to_user.record(MessageTimes::now() - ack.response_rx_ns);
+        std::cout << ack.raw << " in " << std::chrono::duration_cast<std::chrono::microseconds>(ack.round_trip).count() << "us" << std::endl;
+        log_file << ack.raw << ",\n\t";
+        if (ack.order_id >= 0 && ack.transact_ms > 0)
+            telemetry.order_one_way.record(ack.transact_ms * 1000000 - sent_ns - exchange.get_clock_offset_us() * 1000);
+        return ack.order_id;
+    }
+
+    void send_order(Order& o, bool useQuoteOrderQty) {
+        int64_t order_id = new_market_order(o.is_buy, o.quantity, useQuoteOrderQty);
+        if (order_id < 0) {
+            on_order_update(o, OrderState::rejected, 0, 0);
+            return;
+        }
+        positions.on_ack(o, order_id);
+        update_order(o); // fill may come before ack
+    }
 
-        rapidjson::Document doc;
-        doc.Parse(result_str.c_str());
-        auto result = parse_market_order_result(doc);
-        std::cout << "sold " << std::get<1>(result) << " (" << std::get<2>(result) << ") of " << rounded_amount << std::endl;
-        crypto_current_amount = 0;
+    void sell_crypto(Position& p) {
+        TraceScope trace("sell_crypto");
+        timers.cancel(p.exit_timer);
+        double rounded_amount = fix_price(p.amount, !useCurrencyForAmount);
+        Order* o = positions.close(p, false);
+        if (!o) return;
+        o->quantity = rounded_amount;
+        std::cout << "selling " << rounded_amount << std::endl;
+        send_order(*o, !useCurrencyForAmount);
     }
 
     void buy_crypto() {
+        if (positions.position_count() >= max_positions) return;
+        TraceScope trace("buy_crypto");
         double rounded_amount = fix_price(crypto_buy_amount, useCurrencyForAmount);
+        if (uint32_t blocked = check_entry_risk(rounded_amount, useCurrencyForAmount)) {
+            std::cout << "entry blocked by risk checks: " << RiskTable::describe(blocked) << std::endl;
+            entry_ready = false;
+            // band and order rate clear with time, so those are retried after a delay
+            entry_blocked = blocked & (risk_notional | risk_position);
+            if (!entry_blocked) timers.schedule(entry_timer, to_ticks(entry_retry_delay));
+            return;
+        }
+        Position* p = positions.open(true, rounded_amount);
+        if (!p) return;
         std::cout << "buying " << rounded_amount << std::endl;
-        std::string result_str = new_market_order(true, rounded_amount, useCurrencyForAmount);
-        std::cout << result_str << std::endl;
-        log_file << result_str << ",\n\t";
+        entry_ready = false; // one entry at a time, next one after buy delay
+        send_order(*p->order, useCurrencyForAmount);
+    }
+
+    void sell_all() {
+        positions.for_each_position([this](Position& p) { if (p.state == PositionState::open) sell_crypto(p); });
+    }
+
+    void on_order_update(Order& o, OrderState state, double executed, double cum_quote) {
+        Position& p = *o.position;
+        bool entry = p.state == PositionState::opening;
+        bool released = positions.on_update(o, state, executed, cum_quote, symbols[symbol].step_size);
+        open_positions.set(static_cast<double>(positions.position_count()));
+        position_amount.set(positions.total_amount());
+        realized_pnl.set(positions.get_realized_pnl());
+        risk.set_position(risk_slot, positions.total_amount());
+        release_entry_block();
+        if (state != OrderState::filled && state != OrderState::rejected && state != OrderState::canceled) return;
+
+        std::cout << (entry ? "bought " : "sold ") << executed << " (" << cum_quote << "), " << state << std::endl;
+        if (entry) {
+            // rejected entry waits like a filled one, so a venue reject is not sent again on every book update
+            if (released) {
+                timers.schedule(entry_timer, to_ticks(std::max<std::chrono::seconds>(std::chrono::seconds(buy_delay), entry_retry_delay)));
+                return;
+            }
+            timers.schedule(entry_timer, to_ticks(std::chrono::seconds(buy_delay)));
+            timers.schedule(p.exit_timer, to_ticks(std::chrono::seconds(sell_delay)));
+            return;
+        }
+        if (!released) timers.schedule(p.exit_timer, to_ticks(exit_retry_delay));
+    }
+
+    void update_order(Order& o) {
+        if (o.order_id < 0) return;
+        auto update = exchange.take_order_update(o.order_id);
+        if (!update) return;
+        if (update->is_final()) log_file << update->report << ",\n\t";
+        on_order_update(o, update->state, update->executed, update->cum_quote);
+    }
+
+    void update_orders() {
+        positions.for_each_order([this](Order& o) { update_order(o); });
+    }
 
-        rapidjson::Document doc;
-        doc.Parse(result_str.c_str());
-        auto result = parse_market_order_result(doc);
-        std::cout << "bought " << std::get<1>(result) << " (" << std::get<2>(result) << ") of " << rounded_amount << std::endl;
-        crypto_current_amount = std::get<1>(result);
-        crypto_buy_timestamp = std::chrono::steady_clock::now();
+    static uint64_t to_ticks(std::chrono::steady_clock::duration d) { return d / timer_resolution; }
+
+    // wheel is driven by its own timer, so delays fire even when market is quiet
+    void schedule_tick() {
+        tick_timer.expires_at(tick_timer.expiry() + timer_resolution);
+        tick_timer.async_wait([this](beast::error_code ec) {
+            if (ec) return;
+            timers.advance(to_ticks(std::chrono::steady_clock::now() - start_time));
+            schedule_tick();
+        });
+    }
+
+    void on_entry_timer() {
+        entry_ready = true;
+        if (enough_liquidity) buy_crypto();
     }
 
+    void on_exit_timer(Position& p) {
+        if (p.state == PositionState::open) sell_crypto(p);
+    }
+
+
 public:
-    Arbitrage(std::string symbol, const std::string& rest_host, const std::string& ws_host, std::string key, std::string secret, double crypto_buy_amount, net::io_context& io, net::ssl::context& ssl, bool useCurrencyForAmount, int buy_delay, int sell_delay, double activation_threshold, std::ofstream& log_file) :
+    // venue must outlive strategy and is closed after it
+    Arbitrage(Venue& exchange, std::string symbol, std::vector<std::string> ws_hosts, double crypto_buy_amount, net::io_context& io, net::ssl::context& ssl, bool useCurrencyForAmount, int buy_delay, int sell_delay, double activation_threshold, std::ofstream& log_file, size_t max_positions = 1, bool rx_timestamps = false) :
             buy_delay(buy_delay),
             sell_delay(sell_delay),
-            activation_threshold(activation_threshold),
+            threshold(activation_threshold),
             useCurrencyForAmount(useCurrencyForAmount),
             crypto_buy_amount(crypto_buy_amount),
             symbol(std::move(symbol)),
-            rest_api(BinanceRestApi(rest_host, std::move(key), std::move(secret), io, ssl)),
-            web_sockets(BinanceWebSockets(ws_host, "/ws", io, ssl)),
+            max_positions(std::clamp<size_t>(max_positions, 1, position_capacity)),
+            io(io),
+            tick_timer(io),
+            entry_timer([this]() { on_entry_timer(); }),
+            exchange(exchange),
+            ws_hosts(std::move(ws_hosts)),
+            book_sync(io, book, [this](DepthUpdate& out) { return this->exchange.load_book(this->symbol, out); }),
+            risk_slot(risk.add_symbol(this->symbol)),
             log_file(log_file)
     {
+        if (this->ws_hosts.size() > FeedArbiter::max_feeds) throw std::runtime_error("Too many websocket endpoints");
+        for (size_t i = 0; i < this->ws_hosts.size(); ++i) {
+            feeds.push_back(std::make_unique<FeedSupervisor>(feed_io, ssl, this->ws_hosts[i], "/ws", [this, i](rapidjson::Document& doc, MessageTimes& times) { on_feed_message(i, doc, times); }));
+            feeds.back()->set_rx_timestamps(rx_timestamps);
+        }
+        positions.set_exit_callback([this](Position& p) { on_exit_timer(p); });
+        exchange.set_order_callback([this]() { net::post(this->io, [this]() { update_orders(); }); });
+        exchange.watch_book(this->symbol, book);
         update_exchange_info();
         subscribe_to_data();
     }
 
-    void update() {
-        web_sockets.read();
-        rapidjson::Document doc;
-        doc.Parse(web_sockets.read_str_from_buffer().c_str());
-        auto depth = parse_depth_data(doc, crypto_buy_amount);
+    Arbitrage(const Arbitrage&) = delete;
+    Arbitrage& operator=(const Arbitrage&) = delete;
 
-        if (depth.sell_amount >= crypto_buy_amount) {
-            set_new_sell_price(depth.sell_price);
+    ~Arbitrage() {
+        if (!feed_thread.joinable()) return;
+        bus_stop = true;
+        feed_io.stop();
+        feed_thread.join();
+    }
 
-            auto now = std::chrono::steady_clock::now();
-            if (crypto_current_amount <= 0) {
-                if (std::chrono::duration_cast<std::chrono::seconds>(now - crypto_buy_timestamp).count() >= buy_delay)
-                    buy_crypto();
-                return;
-            }
+    // starts reading market data and ticking timers, everything then runs inside io.run()
+    void start() {
+        start_time = std::chrono::steady_clock::now();
+        tick_timer.expires_at(start_time);
+        schedule_tick();
+        for (auto& feed : feeds) feed->start();
+        if (multicast) multicast->start();
+        Tracer::set_thread_name("strategy");
+        feed_thread = std::thread([this]() {
+            Tracer::set_thread_name("feed");
+            if (bus) read_bus();
+            else feed_io.run();
+        });
+    }
 
-            double price_change = get_sell_price_change_percent();
-            if (price_change < -activation_threshold || price_change >= activation_threshold) {
-                sell_crypto();
-                return;
+    // handles market data message, buy and sell delays are handled by timers
+    void update(const DepthUpdate& depth, MessageTimes& times) {
+        if (closed) return;
+        TraceScope trace("update");
+        int64_t start_ns = MessageTimes::now();
+        telemetry.queue_time.record(start_ns - times.parsed_ns);
+        messages_processed.add();
+        {
+            PerfScope scope(perf_regions.strategy);
+            if (apply_to_book(depth)) evaluate();
+        }
+        times.processed_ns = MessageTimes::now();
+        telemetry.process_time.record(times.processed_ns - start_ns);
+    }
+
+    // conflate mode: every queued delta goes into the book, but strategy only sees the newest book
+    // there is one book in this process, so newest state per symbol is the state after the last message
+    void drain() {
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            draining.swap(pending);
+            drain_posted = false;
+        }
+        if (closed || draining.empty()) {
+            draining.clear();
+            return;
+        }
+
+        TraceScope trace("drain");
+        int64_t start_ns = MessageTimes::now();
+        telemetry.drain_lag.record(start_ns - draining.front().times.local_rx_ns);
+        {
+            PerfScope scope(perf_regions.strategy);
+            bool applied = false;
+            for (auto& m : draining) {
+                telemetry.queue_time.record(start_ns - m.times.parsed_ns);
+                applied |= apply_to_book(m.update);
             }
-            if (std::chrono::duration_cast<std::chrono::seconds>(now - crypto_buy_timestamp).count() >= sell_delay)
-                sell_crypto();
+            if (applied) evaluate();
         }
+        telemetry.process_time.record(MessageTimes::now() - start_ns);
+        messages_processed.add(draining.size());
+        messages_conflated.add(draining.size() - 1);
+        draining.clear();
+    }
+
+    // true if book changed
+    bool apply_to_book(const DepthUpdate& depth) {
+        // book is reloaded after start, reconnect or missed update
+        if (book_sync.apply(depth) != BookUpdateResult::applied) return false;
+        bid_levels.set(static_cast<double>(book.get_bids().size()));
+        ask_levels.set(static_cast<double>(book.get_asks().size()));
+        return true;
+    }
+
+    void evaluate() {
+        update_signals();
+        // nothing our order size can reach has changed, so fill estimate and price are the same as last time
+        if (!book.take_dirty()) {
+            evaluations_skipped.add();
+            if (entry_ready && enough_liquidity) buy_crypto();
+            return;
+        }
+        auto depth = parse_depth_data(book, crypto_buy_amount);
+        book.set_watermark(depth.sell_depth, depth.buy_depth);
+
+        enough_liquidity = depth.sell_amount >= crypto_buy_amount;
+        if (!enough_liquidity) return;
+        set_new_sell_price(depth.sell_price);
+
+        if (is_exit_signal(get_sell_price_change_percent())) sell_all();
+        if (entry_ready) buy_crypto();
+    }
+
+    // o(1) per book change, gauges let other threads print them
+    void update_signals() {
+        signals.on_book(book);
+        signal_microprice.set(signals.get_microprice());
+        signal_imbalance.set(signals.get_book_imbalance());
+        signal_volatility.set(signals.get_volatility());
+    }
+
+    // trades only feed signals and bars, closed minute bars with trades go to the log next to orders
+    void on_trade(const Trade& t) {
+        if (closed) return;
+        trades_processed.add();
+        signals.on_trade(t.price, t.quantity, !t.buyer_is_maker);
+        signal_vwap.set(signals.get_vwap());
+        signal_trade_flow.set(signals.get_trade_flow());
+        bars.update(t, [this](TradeBars::Resolution r, const Bar& bar) {
+            // flat bars of intervals without trades are left out
+            if (r != TradeBars::minute || bar.trades == 0) return;
+            log_file << R"({"e":"bar","s":")" << symbol << R"(","i":")" << TradeBars::names[r] << R"(","k":)" << bar << "},\n\t";
+        });
     }
 
     double get_sell_price_change_percent() const {
@@ -214,15 +608,174 @@ public:
         return (current_sell_price / previous_sell_price) - 1.0;
     }
 
+    // fixed threshold until adaptive one is enabled and warmed up, both are checked so they can be compared
+    // a trigger counts once per held position, on the first crossing of each threshold
+    bool is_exit_signal(double change) {
+        static constexpr uint8_t fixed_bit = 1, adaptive_bit = 2;
+        double fixed = threshold.get_fixed();
+        bool fixed_hit = change < -fixed || change >= fixed;
+        if (!threshold.is_enabled()) return fixed_hit;
+
+        double adaptive = threshold.value();
+        adaptive_threshold.set(adaptive);
+        bool adaptive_hit = change < -adaptive || change >= adaptive;
+        if (fixed_hit || adaptive_hit) {
+            positions.for_each_position([&](Position& p) {
+                if (p.state == PositionState::opening) return;
+                if (fixed_hit && !(p.exit_triggers & fixed_bit)) fixed_triggers.add();
+                if (adaptive_hit && !(p.exit_triggers & adaptive_bit)) adaptive_triggers.add();
+                p.exit_triggers |= (fixed_hit ? fixed_bit : 0) | (adaptive_hit ? adaptive_bit : 0);
+            });
+        }
+        return threshold_compare ? fixed_hit : adaptive_hit;
+    }
+
+    // volatility only sees real changes, repeated prices of unchanged top levels would shrink it
     void set_new_sell_price(double v) {
+        if (v != current_sell_price) threshold.update(v);
         iterations++;
         previous_sell_price = current_sell_price;
         current_sell_price = v;
     }
 
+    // activation threshold becomes multiplier * volatility of sell price changes within [min, max], after a warmup
+    // of threshold_window changes; in compare mode fixed threshold keeps trading and adaptive one runs in shadow
+    // must be set before start()
+    [[maybe_unused]] void set_adaptive_threshold(double multiplier, double min, double max, bool compare) {
+        threshold.enable(multiplier, min, max);
+        threshold_compare = compare;
+    }
+
+    // trades of the symbol on the same websockets as depth, aggregate trades unless 'aggregate' is false
+    // must be set before start(), not available when books come from feed handler
+    [[maybe_unused]] void set_trade_stream(bool aggregate) {
+        if (feeds.empty()) {
+            std::cout << "trades need own websocket market data" << std::endl;
+            return;
+        }
+        for (auto& feed : feeds) feed->subscribe(exchange.trade_stream(symbol, aggregate));
+    }
+
+    // entries breaking any limit are not sent and count as rejected, exits are never blocked
+    // strategy thread only once started
+    [[maybe_unused]] void set_risk_limits(const RiskLimits& limits) {
+        risk.set_limits(risk_slot, limits);
+        release_entry_block();
+    }
+
+    // must be set before start()
+    [[maybe_unused]] void set_conflate(bool enable) { conflate = enable; }
+
+    // books come from feed handler over shared memory bus, must be set before start() and without websocket endpoints
+    [[maybe_unused]] void set_book_bus(const std::string& name) { bus = std::make_unique<ShmSubscriber>(name); }
+
+    // books come from feed handler over udp multicast, missed ones are asked from its recovery port
+    // must be set before start() and without websocket endpoints
+    [[maybe_unused]] void set_book_multicast(const std::string& group, uint16_t port, const std::string& recovery_host, uint16_t recovery_port, const std::string& interface = "") {
+        multicast = std::make_unique<MulticastSubscriber>(feed_io, group, port, recovery_host, recovery_port, [this](const BookSnapshot& s) { on_book_snapshot_received(s); }, interface);
+    }
+
+    [[maybe_unused]] const Venue& get_exchange() const { return exchange; }
+    [[maybe_unused]] uint64_t get_reconnects() const {
+        uint64_t sum = 0;
+        for (auto& feed : feeds) sum += feed->get_reconnects();
+        return sum;
+    }
+    [[maybe_unused]] const FeedArbiter& get_arbiter() const { return arbiter; }
+    [[maybe_unused]] size_t get_position_count() const { return positions.position_count(); }
+    [[maybe_unused]] double get_crypto_amount() const { return positions.total_amount(); }
+    [[maybe_unused]] const Telemetry& get_telemetry() const { return telemetry; }
+    // strategy thread only
+    [[maybe_unused]] const MarketSignals<>& get_signals() const { return signals; }
+    [[maybe_unused]] const TradeBars& get_bars() const { return bars; }
+
+    // histograms are atomic, may be called from any thread
+    void print_stats() const {
+        std::cout << telemetry << std::endl;
+        if (threshold.is_enabled())
+            std::cout << "threshold: fixed " << threshold.get_fixed() << ", adaptive " << adaptive_threshold.get() << (threshold_compare ? " (shadow)" : " (trading)")
+                      << ", positions triggered: fixed " << fixed_triggers.get() << ", adaptive " << adaptive_triggers.get() << std::endl;
+        const LatencyHistogram& check = risk.get_check_time();
+        std::cout << "risk: passed " << risk.get_passed(risk_slot);
+        for (size_t i = 0; i < RiskTable::reason_count; ++i) std::cout << ", " << RiskTable::reason_names[i] << " " << risk.get_rejects(risk_slot, i);
+        std::cout << ", check p50 " << check.percentile(0.5) << " ns, max " << check.get_max() << " ns" << std::endl;
+        std::cout << "signals: microprice " << signal_microprice.get() << ", book imbalance " << signal_imbalance.get() << ", volatility " << signal_volatility.get();
+        if (trades_processed.get() > 0) std::cout << ", trades " << trades_processed.get() << ", vwap " << signal_vwap.get() << ", trade flow " << signal_trade_flow.get();
+        std::cout << std::endl;
+        if (PerfCounters::is_enabled()) std::cout << perf_regions << std::endl;
+    }
+
+    // prometheus text, only reads atomics, so it may run on any thread
+    std::string render_metrics() const {
+        static constexpr const char* limit_types[] = {"request_weight", "orders", "raw_requests"};
+        PrometheusWriter w;
+        w.counter("arb_messages_received_total", "Market data messages read from all feeds, duplicates included", static_cast<double>(messages_received.get()));
+        w.counter("arb_messages_processed_total", "Market data messages handled by strategy", static_cast<double>(messages_processed.get()));
+        w.summary("arb_parse_seconds", "Json parse time of market data message", telemetry.parse_time);
+        w.summary("arb_feed_one_way_seconds", "Exchange event time to local receive, clock corrected", telemetry.one_way_delay);
+        w.summary("arb_strategy_seconds", "Strategy time per market data message", telemetry.process_time);
+        w.counter("arb_messages_conflated_total", "Messages applied to book without own strategy run", static_cast<double>(messages_conflated.get()));
+        w.counter("arb_evaluations_skipped_total", "Book updates below the depth our order size reaches", static_cast<double>(evaluations_skipped.get()));
+        if (bus) {
+            w.counter("arb_bus_gaps_total", "Records of market data bus missed by this reader", static_cast<double>(bus->get_gaps()));
+            w.summary("arb_bus_delay_seconds", "Feed handler publish to read from market data bus", telemetry.bus_delay);
+        }
+        if (multicast) {
+            w.counter("arb_multicast_gaps_total", "Multicast datagrams missed by this reader", static_cast<double>(multicast->get_gaps()));
+            w.counter("arb_multicast_recovered_total", "Books received over recovery connection", static_cast<double>(multicast->get_recovered()));
+            w.summary("arb_bus_delay_seconds", "Feed handler publish to receive, clocks of both hosts", telemetry.bus_delay);
+        }
+        w.summary("arb_drain_lag_seconds", "Receive of oldest queued message to start of its drain", telemetry.drain_lag);
+        w.gauge("arb_book_levels", "Price levels in local order book", bid_levels.get(), "side=\"bid\"");
+        w.gauge("arb_book_levels", "Price levels in local order book", ask_levels.get(), "side=\"ask\"");
+        w.gauge("arb_signal_microprice", "Mid price weighted by quantity on the other side of top level", signal_microprice.get());
+        w.gauge("arb_signal_book_imbalance", "Bid minus ask quantity over both, top 5 levels", signal_imbalance.get());
+        w.gauge("arb_signal_volatility", "Standard deviation of mid price changes over last 256 book updates", signal_volatility.get());
+        if (threshold.is_enabled()) {
+            w.gauge("arb_activation_threshold", "Adaptive activation threshold, fixed one until warmed up", adaptive_threshold.get());
+            w.counter("arb_exit_triggers_total", "Held positions that saw a price move over threshold", static_cast<double>(fixed_triggers.get()), "threshold=\"fixed\"");
+            w.counter("arb_exit_triggers_total", "Held positions that saw a price move over threshold", static_cast<double>(adaptive_triggers.get()), "threshold=\"adaptive\"");
+        }
+        w.counter("arb_trades_processed_total", "Trades of the symbol handled by strategy", static_cast<double>(trades_processed.get()));
+        w.gauge("arb_signal_vwap", "Volume weighted price of last 256 trades", signal_vwap.get());
+        w.gauge("arb_signal_trade_flow", "Taker buy minus sell quantity over both, last 256 trades", signal_trade_flow.get());
+        w.counter("arb_risk_passed_total", "Orders that passed pre-trade risk checks", static_cast<double>(risk.get_passed(risk_slot)));
+        for (size_t i = 0; i < RiskTable::reason_count; ++i)
+            w.counter("arb_risk_rejects_total", "Orders blocked by pre-trade risk checks, by failed limit", static_cast<double>(risk.get_rejects(risk_slot, i)), std::string("reason=\"") + RiskTable::reason_names[i] + "\"");
+        w.counter("arb_orders_sent_total", "Orders sent to exchange", static_cast<double>(orders_sent.get()));
+        w.summary("arb_order_round_trip_seconds", "Order request round trip", telemetry.order_round_trip);
+        if (const RateLimiter* rate_limiter = exchange.get_rate_limiter()) {
+            for (size_t i = 0; i < rate_limiter->size(); ++i) {
+                const RateLimit& l = (*rate_limiter)[i];
+                w.gauge("arb_rate_limit_usage_ratio", "Used share of exchange rate limit", rate_limiter->usage(i), std::string("type=\"") + limit_types[static_cast<int>(l.type)] + "\",interval=\"" + l.header_suffix + "\"");
+            }
+            w.gauge("arb_rate_limit_banned", "1 while exchange ban is in effect", rate_limiter->is_banned() ? 1 : 0);
+        }
+        for (size_t i = 0; i < feeds.size(); ++i)
+            w.counter("arb_feed_reconnects_total", "Market data reconnects", static_cast<double>(feeds[i]->get_reconnects()), "host=\"" + ws_hosts[i] + "\"");
+        for (size_t i = 0; i < feeds.size(); ++i)
+            w.gauge("arb_feed_connected", "1 while market data connection is up", feeds[i]->is_connected() ? 1 : 0, "host=\"" + ws_hosts[i] + "\"");
+        w.gauge("arb_open_positions", "Positions held now", open_positions.get());
+        w.gauge("arb_position_amount", "Crypto held in open positions", position_amount.get());
+        w.gauge("arb_realized_pnl", "Revenue minus cost of closed positions, in quote currency", realized_pnl.get());
+        return w.str();
+    }
+
+    // must be called on io thread, io.run() returns once everything is closed
     void close() {
-        web_sockets.close();
-        rest_api.close();
+        closed = true;
+        tick_timer.cancel();
+        book_sync.cancel();
+        timers.cancel(entry_timer);
+        positions.for_each_position([this](Position& p) { timers.cancel(p.exit_timer); });
+        bus_stop = true;
+        net::post(feed_io, [this]() {
+            for (auto& feed : feeds) feed->close();
+            if (multicast) multicast->close();
+        });
+        if (feed_thread.joinable()) feed_thread.join();
+        print_feed_stats();
+        print_stats();
     }
 };
 
@@ -0,0 +1,133 @@
+#ifndef ARB_BARS_H
+#define ARB_BARS_H
+
+#include <cinttypes>
+#include <algorithm>
+#include <ostream>
+#include "signals.h"
+
+// one trade, or one aggregate of trades of the same taker order at the same price
+struct Trade {
+public:
+    uint64_t id;          // trade id, or aggregate trade id
+    double price;
+    double quantity;
+    int64_t trade_ms;     // venue time of the trade
+    bool buyer_is_maker;  // true when seller was the taker
+};
+
+struct Bar {
+public:
+    int64_t open_ms{}; // start of the interval
+    double open{};
+    double high{};
+    double low{};
+    double close{};
+    double volume{};       // base asset
+    double quote_volume{};
+    double buy_volume{};   // bought by takers
+    uint32_t trades{};
+
+    friend std::ostream& operator<<(std::ostream& os, const Bar& b) {
+        os << R"({"t":)" << b.open_ms << R"(,"o":)" << b.open << R"(,"h":)" << b.high << R"(,"l":)" << b.low << R"(,"c":)" << b.close
+           << R"(,"v":)" << b.volume << R"(,"q":)" << b.quote_volume << R"(,"V":)" << b.buy_volume << R"(,"n":)" << b.trades << "}";
+        return os;
+    }
+};
+
+// ohlcv bars of one interval built trade by trade, last Capacity closed bars are kept
+// a bar is closed by the first trade of a later interval, intervals without trades become flat bars
+// at the previous close, so bar i is always i intervals before the current one
+template<size_t Capacity>
+class BarSeries {
+private:
+    int64_t interval_ms;
+    RingBuffer<Bar, Capacity> closed;
+    Bar current{};
+    bool started{};
+private:
+    void open_bar(int64_t open_ms, double price) {
+        current = Bar{};
+        current.open_ms = open_ms;
+        current.open = current.high = current.low = current.close = price;
+    }
+public:
+    explicit BarSeries(int64_t interval_ms) : interval_ms(interval_ms) { }
+
+    // on_close(const Bar&) is called for every bar closed by this trade, oldest first
+    // trades older than current bar are counted into it
+    template<class OnClose>
+    void update(const Trade& t, OnClose&& on_close) {
+        int64_t open_ms = t.trade_ms - t.trade_ms % interval_ms;
+        if (!started) {
+            open_bar(open_ms, t.price);
+            started = true;
+        }
+        else if (open_ms > current.open_ms) {
+            closed.push(current);
+            on_close(current);
+            // at most a ring of flat bars, older ones would be overwritten anyway
+            int64_t missing = std::min<int64_t>((open_ms - current.open_ms) / interval_ms - 1, Capacity);
+            double last = current.close;
+            for (int64_t i = missing; i > 0; --i) {
+                open_bar(open_ms - i * interval_ms, last);
+                closed.push(current);
+                on_close(current);
+            }
+            open_bar(open_ms, t.price);
+        }
+
+        current.high = std::max(current.high, t.price);
+        current.low = std::min(current.low, t.price);
+        current.close = t.price;
+        current.volume += t.quantity;
+        current.quote_volume += t.price * t.quantity;
+        if (!t.buyer_is_maker) current.buy_volume += t.quantity;
+        current.trades++;
+    }
+
+    // bar still being built, empty until first trade
+    [[nodiscard]] const Bar& get_current() const { return current; }
+    // 0 is the newest closed bar
+    [[nodiscard]] const Bar& get_closed(size_t age) const { return closed[age]; }
+    [[nodiscard]] size_t closed_count() const { return closed.size(); }
+    [[nodiscard]] int64_t get_interval_ms() const { return interval_ms; }
+};
+
+// 1 second, 1 minute and 5 minute bars of one symbol, all storage is inside the object
+class TradeBars {
+public:
+    enum Resolution { second, minute, five_minutes, resolution_count };
+    static constexpr const char* names[resolution_count] = {"1s", "1m", "5m"};
+private:
+    BarSeries<512> bars_1s{1000};
+    BarSeries<256> bars_1m{60 * 1000};
+    BarSeries<256> bars_5m{5 * 60 * 1000};
+    uint64_t trade_count{};
+public:
+    // on_close(Resolution, const Bar&) is called for every closed bar
+    template<class OnClose>
+    void update(const Trade& t, OnClose&& on_close) {
+        trade_count++;
+        bars_1s.update(t, [&](const Bar& b) { on_close(second, b); });
+        bars_1m.update(t, [&](const Bar& b) { on_close(minute, b); });
+        bars_5m.update(t, [&](const Bar& b) { on_close(five_minutes, b); });
+    }
+
+    [[nodiscard]] const Bar& get_current(Resolution r) const {
+        return r == second ? bars_1s.get_current() : r == minute ? bars_1m.get_current() : bars_5m.get_current();
+    }
+
+    // false if there is no closed bar of that age yet
+    [[nodiscard]] bool get_closed(Resolution r, size_t age, Bar& out) const {
+        size_t count = r == second ? bars_1s.closed_count() : r == minute ? bars_1m.closed_count() : bars_5m.closed_count();
+        if (age >= count) return false;
+        out = r == second ? bars_1s.get_closed(age) : r == minute ? bars_1m.get_closed(age) : bars_5m.get_closed(age);
+        return true;
+    }
+
+    [[nodiscard]] uint64_t get_trade_count() const { return trade_count; }
+};
+
+
+#endif //ARB_BARS_H
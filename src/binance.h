@@ -0,0 +1,215 @@
+#ifndef ARB_BINANCE_H
+#define ARB_BINANCE_H
+
+#include <cinttypes>
+#include <string>
+#include <memory>
+#include <optional>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include "../include/rapidjson/document.h"
+#include "exchange.h"
+#include "web.h"
+#include "user_data.h"
+#include "time_sync.h"
+#include "rate_limit.h"
+#include "feed_supervisor.h"
+#include "perf_counters.h"
+
+// binance spot: diff depth streams, /api/v3 rest, orders signed with hmac and fills from user data stream
+// without api key only market data and symbol metadata are available
+class BinanceExchange : public Exchange<BinanceExchange> {
+    friend class Exchange<BinanceExchange>;
+public:
+    static constexpr int64_t depth_weight = 50; // /api/v3/depth with limit 1000
+private:
+    RateLimiter rate_limiter;
+    TimeSync time_sync;
+    AccountCache account_cache;
+    std::function<void()> order_callback;
+    std::optional<UserDataStream> user_data;
+    RestApi rest_api;
+private:
+    // [["price", "quantity"], ...]
+    static void parse_levels(const rapidjson::Value& levels, std::vector<BookLevel>& out) {
+        out.clear();
+        out.reserve(levels.Size());
+        for (rapidjson::SizeType i = 0; i < levels.Size(); ++i)
+            out.push_back(BookLevel{std::stod(levels[i][0].GetString()), std::stod(levels[i][1].GetString())});
+    }
+
+    static OrderState parse_order_status(const std::string& status) {
+        if (status == "FILLED") return OrderState::filled;
+        if (status == "PARTIALLY_FILLED") return OrderState::partially_filled;
+        if (status == "REJECTED") return OrderState::rejected;
+        if (status == "CANCELED" || status == "EXPIRED" || status == "EXPIRED_IN_MATCH") return OrderState::canceled;
+        return OrderState::acked;
+    }
+
+    [[nodiscard]] std::string depth_stream_impl(const std::string& symbol) const { return depth_stream_name(symbol); }
+
+    bool update_ids_impl(const rapidjson::Value& event, uint64_t& first_id, uint64_t& final_id) const { return get_update_ids(event, first_id, final_id); }
+
+    bool parse_depth_impl(const rapidjson::Value& event, DepthUpdate& out) const { return parse_depth_event(event, out); }
+
+    [[nodiscard]] std::string trade_stream_impl(const std::string& symbol, bool aggregate) const { return trade_stream_name(symbol, aggregate); }
+
+    bool parse_trade_impl(const rapidjson::Value& event, Trade& out) const { return parse_trade_event(event, out); }
+
+    BookLoad load_book_impl(const std::string& symbol, DepthUpdate& out) {
+        BookLoad load;
+        load.retry_after = std::chrono::nanoseconds(rate_limiter.acquire_or_wait(RequestPriority::info, depth_weight));
+        if (load.retry_after.count() > 0) return load;
+        auto result = rest_api.get("/api/v3/depth", "symbol=" + symbol + "&limit=1000", false);
+        rapidjson::Document doc;
+        doc.Parse(result.second.body().c_str());
+        load.loaded = parse_depth_snapshot(doc, out);
+        if (!load.loaded) std::cout << BinanceResult{doc["code"].GetInt(), doc["msg"].GetString()} << std::endl;
+        return load;
+    }
+
+    // orders are sent with ACK response type, executed quantity comes later from user data stream
+    OrderAck new_market_order_impl(const std::string& symbol, bool is_buy, double quantity, bool quote_quantity) {
+        OrderAck ack;
+        if (!user_data) {
+            std::cout << "orders need api key" << std::endl;
+            return ack;
+        }
+        if (!rate_limiter.try_acquire(RequestPriority::order, 1, true)) return ack;
+        ack.sent = true;
+        std::string target;
+        {
+            PerfScope scope(perf_regions.order_build);
+            std::string query = "type=MARKET&newOrderRespType=ACK&symbol=" + symbol + "&side=" + (is_buy ? "BUY" : "SELL") + (quote_quantity ? "&quoteOrderQty=" : "&quantity=") + std::to_string(quantity);
+            target = rest_api.make_target("/api/v3/order", std::move(query), true);
+        }
+        auto result = rest_api.post(target, true);
+        ack.round_trip = rest_api.get_last_round_trip();
+        ack.response_rx_ns = rest_api.get_last_rx_timestamp().software_ns;
+        ack.raw = std::move(result.second.body());
+
+        rapidjson::Document doc;
+        doc.Parse(ack.raw.c_str());
+        if (!doc.HasMember("orderId")) {
+            std::cout << BinanceResult{doc["code"].GetInt(), doc["msg"].GetString()} << std::endl;
+            return ack;
+        }
+        if (doc.HasMember("transactTime")) ack.transact_ms = doc["transactTime"].GetInt64();
+        ack.order_id = doc["orderId"].GetInt64();
+        account_cache.track_order(ack.order_id, symbol);
+        return ack;
+    }
+
+    std::optional<OrderUpdate> take_order_update_impl(int64_t order_id) {
+        auto fill = account_cache.take_order_update(order_id);
+        if (!fill) return std::nullopt;
+        return OrderUpdate{parse_order_status(fill->status), fill->executed, fill->cum_quote, std::move(fill->report)};
+    }
+
+    void set_order_callback_impl(std::function<void()> callback) { order_callback = std::move(callback); }
+
+    void load_symbols_impl(std::unordered_map<std::string, SymbolInfo>& out) {
+        rate_limiter.acquire(RequestPriority::info, 20);
+        auto result = rest_api.get("/api/v3/exchangeInfo", "", false);
+        rapidjson::Document doc;
+        doc.Parse(result.second.body().c_str());
+
+        rate_limiter.seed(doc["rateLimits"]);
+        out.clear();
+
+        auto symbols = doc["symbols"].GetArray();
+        for (rapidjson::SizeType i = 0; i < symbols.Size(); ++i) {
+            std::string s = symbols[i]["symbol"].GetString();
+            auto filters = symbols[i]["filters"].GetArray();
+            double step = 0;
+            for (rapidjson::SizeType j = 0; j < filters.Size(); ++j) {
+                if (strcmp(filters[j]["filterType"].GetString(), "LOT_SIZE") != 0) continue;
+                step = std::stod(filters[j]["stepSize"].GetString());
+                break;
+            }
+
+            out.emplace(s, SymbolInfo{step});
+        }
+    }
+
+    [[nodiscard]] int64_t get_clock_offset_us_impl() const { return time_sync.get_offset().load(std::memory_order_relaxed); }
+    [[nodiscard]] const RateLimiter* get_rate_limiter_impl() const { return &rate_limiter; }
+
+    void close_impl() {
+        time_sync.close();
+        if (user_data) user_data->close();
+        rest_api.close();
+    }
+
+public:
+    // user data stream is opened only with api key
+    BinanceExchange(const std::string& rest_host, const std::string& user_ws_host, std::string key, std::string secret, net::io_context& io, net::ssl::context& ssl, int recv_window_ms = 0, bool rx_timestamps = false) :
+            time_sync(rest_host, ssl, &rate_limiter),
+            rest_api(BinanceRestApi(rest_host, key, secret, io, ssl))
+    {
+        if (!key.empty())
+            user_data.emplace(rest_host, user_ws_host, std::move(key), std::move(secret), ssl, account_cache, &rate_limiter, &time_sync.get_offset(),
+                              [this]() { if (order_callback) order_callback(); });
+        if (rx_timestamps && !rest_api.enable_rx_timestamps()) std::cout << "kernel receive timestamps are not supported for orders" << std::endl;
+        rest_api.set_rate_limiter(&rate_limiter);
+        rest_api.set_clock_offset(&time_sync.get_offset());
+        rest_api.set_recv_window(recv_window_ms);
+    }
+
+    static std::string depth_stream_name(const std::string& symbol) {
+        std::string lowercase = symbol;
+        std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(), [](unsigned char c){ return std::tolower(c); } );
+        return lowercase + "@depth@100ms";
+    }
+
+    static std::string trade_stream_name(const std::string& symbol, bool aggregate) {
+        std::string lowercase = symbol;
+        std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(), [](unsigned char c){ return std::tolower(c); } );
+        return lowercase + (aggregate ? "@aggTrade" : "@trade");
+    }
+
+    // '<symbol>@aggTrade' or '<symbol>@trade' event, fields are read by fixed names and numbers straight from strings
+    static bool parse_trade_event(const rapidjson::Value& event, Trade& out) {
+        if (!event.HasMember("e")) return false;
+        const char* type = event["e"].GetString();
+        const char* id_field;
+        if (strcmp(type, "aggTrade") == 0) id_field = "a";
+        else if (strcmp(type, "trade") == 0) id_field = "t";
+        else return false;
+        out.id = event[id_field].GetUint64();
+        out.price = std::strtod(event["p"].GetString(), nullptr);
+        out.quantity = std::strtod(event["q"].GetString(), nullptr);
+        out.trade_ms = event["T"].GetInt64();
+        out.buyer_is_maker = event["m"].GetBool();
+        return true;
+    }
+
+    // diff depth event from <symbol>@depth stream
+    static bool parse_depth_event(const rapidjson::Value& event, DepthUpdate& out) {
+        if (!event.HasMember("e") || strcmp(event["e"].GetString(), "depthUpdate") != 0) return false;
+        out.first_id = event["U"].GetUint64();
+        out.final_id = event["u"].GetUint64();
+        out.event_ms = event["E"].GetInt64();
+        parse_levels(event["b"], out.bids);
+        parse_levels(event["a"], out.asks);
+        return true;
+    }
+
+    // response of /api/v3/depth
+    static bool parse_depth_snapshot(const rapidjson::Value& doc, DepthUpdate& out) {
+        if (!doc.HasMember("lastUpdateId")) return false;
+        out.first_id = out.final_id = doc["lastUpdateId"].GetUint64();
+        out.event_ms = 0;
+        parse_levels(doc["bids"], out.bids);
+        parse_levels(doc["asks"], out.asks);
+        return true;
+    }
+
+    [[maybe_unused]] const AccountCache& get_account() const { return account_cache; }
+    [[maybe_unused]] const TimeSync& get_time_sync() const { return time_sync; }
+};
+
+
+#endif //ARB_BINANCE_H
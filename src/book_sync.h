@@ -0,0 +1,108 @@
+#ifndef ARB_BOOK_SYNC_H
+#define ARB_BOOK_SYNC_H
+
+#include <cinttypes>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include "web.h"
+#include "order_book.h"
+
+// result of a book snapshot request
+struct BookLoad {
+public:
+    bool loaded{};
+    std::chrono::nanoseconds retry_after{}; // held back by rate limits before anything was sent, retry after this
+};
+
+// keeps a book synced with its diff stream the way binance describes it: after start and after every gap,
+// diffs are buffered while one snapshot reload is pending, then diffs the snapshot already includes are
+// dropped and the rest applied on top of it
+// reload runs on a timer, never inline on the message that found the gap, so io thread doesn't sleep on
+// rate limits and reloads are at least reload_interval apart; failed requests double that, up to max_reload_interval,
+// snapshot that loaded but is older than buffered diffs is retried after reload_interval
+class BookSync {
+public:
+    using Loader = std::function<BookLoad(DepthUpdate&)>;
+    static constexpr std::chrono::seconds reload_interval{1};
+    static constexpr std::chrono::seconds max_reload_interval{30};
+    static constexpr size_t max_buffered = 4096; // oldest diffs are dropped beyond this, snapshot then has to be newer
+private:
+    OrderBook& book;
+    Loader loader;
+    net::steady_timer reload_timer;
+    DepthUpdate snapshot;
+    std::deque<DepthUpdate> buffered;
+    bool pending{};
+    std::chrono::steady_clock::time_point last_reload{};
+    std::chrono::seconds backoff{reload_interval};
+    std::atomic<uint64_t> reloads{0}; // read by stats from other threads
+    std::atomic<uint64_t> failed_reloads{0};
+private:
+    void schedule(std::chrono::steady_clock::time_point at) {
+        reload_timer.expires_at(at);
+        reload_timer.async_wait([this](beast::error_code ec) {
+            if (ec || !pending) return;
+            reload();
+        });
+    }
+
+    void reload() {
+        BookLoad load = loader(snapshot);
+        if (load.retry_after.count() > 0) return schedule(std::chrono::steady_clock::now() + load.retry_after);
+        last_reload = std::chrono::steady_clock::now();
+        if (load.loaded) backoff = reload_interval; // rest works, only failed requests back off
+        if (load.loaded && replay()) {
+            reloads.fetch_add(1, std::memory_order_relaxed);
+            pending = false;
+            buffered.clear();
+            return;
+        }
+        // snapshot failed or is older than buffered diffs, buffer is kept for the next one
+        failed_reloads.fetch_add(1, std::memory_order_relaxed);
+        if (!load.loaded) backoff = std::min(backoff * 2, max_reload_interval);
+        schedule(last_reload + backoff);
+    }
+
+    // true if buffered diffs continue the snapshot
+    bool replay() {
+        book.load_snapshot(snapshot);
+        for (auto& update : buffered)
+            if (book.apply(update) == BookUpdateResult::gap) return false;
+        return true;
+    }
+public:
+    BookSync(net::io_context& io, OrderBook& book, Loader loader) : book(book), loader(std::move(loader)), reload_timer(io) { }
+
+    BookSync(const BookSync&) = delete;
+    BookSync& operator=(const BookSync&) = delete;
+
+    // same results as OrderBook::apply, gap means the update was buffered until book is reloaded
+    BookUpdateResult apply(const DepthUpdate& update) {
+        if (!pending) {
+            auto result = book.apply(update);
+            if (result != BookUpdateResult::gap) return result;
+            pending = true;
+            schedule(std::max(std::chrono::steady_clock::now(), last_reload + backoff));
+        }
+        if (buffered.size() >= max_buffered) buffered.pop_front();
+        buffered.push_back(update);
+        return BookUpdateResult::gap;
+    }
+
+    // drops pending reload, so io context can run out of work on shutdown
+    void cancel() {
+        reload_timer.cancel();
+        pending = false;
+        buffered.clear();
+    }
+
+    [[nodiscard]] bool is_pending() const { return pending; }
+    [[nodiscard]] uint64_t get_reloads() const { return reloads.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t get_failed_reloads() const { return failed_reloads.load(std::memory_order_relaxed); }
+};
+
+
+#endif //ARB_BOOK_SYNC_H
@@ -0,0 +1,136 @@
+#ifndef ARB_CONSOLIDATED_BOOK_H
+#define ARB_CONSOLIDATED_BOOK_H
+
+#include <cinttypes>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include "order_book.h"
+
+struct VenueLevel {
+public:
+    double price;    // fee adjusted
+    double quantity;
+    uint32_t venue;
+};
+
+// buy on one venue and sell on another, prices are fee adjusted so profit is net of taker fees
+struct CrossOpportunity {
+public:
+    size_t buy_venue;
+    size_t sell_venue;
+    double quantity;
+    double cost;      // quote paid on buy venue
+    double proceeds;  // quote received on sell venue
+    double profit;
+
+    [[nodiscard]] double edge() const { return cost > 0 ? profit / cost : 0; }
+};
+
+// top of the book of one instrument on several venues, every venue writes its own slot from its own
+// thread and anyone reads all of them; bids are stored as price * (1 - fee) and asks as price * (1 + fee),
+// so levels of different venues compare directly
+// fixed size and no allocations, slots are seqlocks like records of market data bus
+class ConsolidatedBook {
+public:
+    static constexpr size_t max_venues = 8;
+    static constexpr size_t max_levels = BookSnapshot::max_levels;
+private:
+    struct alignas(64) Slot {
+    public:
+        std::atomic<uint64_t> seq{0}; // odd while written, 0 until first book
+        double taker_fee{};
+        BookSnapshot book{};
+    };
+
+    std::array<Slot, max_venues> slots;
+    size_t venue_count;
+public:
+    explicit ConsolidatedBook(size_t venue_count) : venue_count(venue_count) {
+        if (venue_count > max_venues) throw std::runtime_error("Too many venues");
+    }
+
+    ConsolidatedBook(const ConsolidatedBook&) = delete;
+    ConsolidatedBook& operator=(const ConsolidatedBook&) = delete;
+
+    // set before any publish
+    void set_taker_fee(size_t venue, double fee) { slots[venue].taker_fee = fee; }
+
+    // single writer per venue
+    void publish(size_t venue, const OrderBook& book, int64_t exchange_ms, int64_t publish_ns) {
+        Slot& s = slots[venue];
+        uint64_t seq = s.seq.load(std::memory_order_relaxed);
+        s.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        book.make_snapshot(s.book);
+        s.book.exchange_ms = exchange_ms;
+        s.book.publish_ns = publish_ns;
+        for (uint32_t i = 0; i < s.book.bid_count; ++i) s.book.bids[i].price *= 1 - s.taker_fee;
+        for (uint32_t i = 0; i < s.book.ask_count; ++i) s.book.asks[i].price *= 1 + s.taker_fee;
+        s.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // false until venue published its first book
+    bool read(size_t venue, BookSnapshot& out) const {
+        const Slot& s = slots[venue];
+        for (;;) {
+            uint64_t before = s.seq.load(std::memory_order_acquire);
+            if (before == 0) return false;
+            if (before & 1) continue;
+            std::memcpy(&out, &s.book, sizeof(BookSnapshot));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) == before) return true;
+        }
+    }
+
+    // best levels of all venues as one side, k-way merge of sorted venue sides
+    static size_t merge(const BookSnapshot* books, size_t count, bool bids, VenueLevel* out, size_t max) {
+        std::array<uint32_t, max_venues> pos{};
+        size_t n = 0;
+        while (n < max) {
+            size_t best = max_venues;
+            for (size_t v = 0; v < count; ++v) {
+                uint32_t size = bids ? books[v].bid_count : books[v].ask_count;
+                if (pos[v] >= size) continue;
+                double p = (bids ? books[v].bids : books[v].asks)[pos[v]].price;
+                if (best == max_venues) { best = v; continue; }
+                double b = (bids ? books[best].bids : books[best].asks)[pos[best]].price;
+                if (bids ? p > b : p < b) best = v;
+            }
+            if (best == max_venues) break;
+            const BookLevel& l = (bids ? books[best].bids : books[best].asks)[pos[best]++];
+            out[n++] = VenueLevel{l.price, l.quantity, static_cast<uint32_t>(best)};
+        }
+        return n;
+    }
+
+    // walks asks of buy book and bids of sell book while bid is above ask, up to max_quantity
+    static bool find_cross(const BookSnapshot& buy_book, const BookSnapshot& sell_book, double max_quantity, CrossOpportunity& out) {
+        out.quantity = out.cost = out.proceeds = 0;
+        uint32_t a = 0, b = 0;
+        double ask_left = buy_book.ask_count > 0 ? buy_book.asks[0].quantity : 0;
+        double bid_left = sell_book.bid_count > 0 ? sell_book.bids[0].quantity : 0;
+        while (a < buy_book.ask_count && b < sell_book.bid_count && out.quantity < max_quantity) {
+            double ask = buy_book.asks[a].price;
+            double bid = sell_book.bids[b].price;
+            if (bid <= ask) break;
+            double take = std::min({ask_left, bid_left, max_quantity - out.quantity});
+            out.quantity += take;
+            out.cost += take * ask;
+            out.proceeds += take * bid;
+            ask_left -= take;
+            bid_left -= take;
+            if (ask_left <= 0 && ++a < buy_book.ask_count) ask_left = buy_book.asks[a].quantity;
+            if (bid_left <= 0 && ++b < sell_book.bid_count) bid_left = sell_book.bids[b].quantity;
+        }
+        out.profit = out.proceeds - out.cost;
+        return out.quantity > 0;
+    }
+
+    [[nodiscard]] size_t size() const { return venue_count; }
+};
+
+
+#endif //ARB_CONSOLIDATED_BOOK_H
@@ -0,0 +1,415 @@
+#ifndef ARB_CROSS_ARBITRAGE_H
+#define ARB_CROSS_ARBITRAGE_H
+
+#include <cinttypes>
+#include <array>
+#include <tuple>
+#include <mutex>
+#include <cmath>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <utility>
+#include "../include/rapidjson/document.h"
+#include "web.h"
+#include "exchange.h"
+#include "order_book.h"
+#include "consolidated_book.h"
+#include "feed_supervisor.h"
+#include "feed_arbiter.h"
+#include "telemetry.h"
+#include "tracer.h"
+
+struct CrossVenueConfig {
+public:
+    std::string symbol;                // instrument name on this venue
+    std::vector<std::string> ws_hosts; // market data endpoints
+    double taker_fee;                  // for example 0.001 for 0.1%
+};
+
+// buys an instrument on one venue and sells it on another when fee adjusted bid of one is above
+// fee adjusted ask of the other for enough depth
+// every venue has its own lane thread with its feeds, book and order entry, so a venue adapter is only
+// used from one thread; lanes publish top of their book into consolidated book and run detection
+// right after, both legs are then sent at the same time from their own lanes
+// legs need base and quote inventory on both venues, one cycle is in flight at a time
+// when legs fill different amounts, the difference is flattened on the venue that filled more; if that
+// fails too, or a leg gets no final update in time, nothing more is fired until restart
+template<class... Venues>
+class CrossArbitrage {
+public:
+    static constexpr size_t venue_count = sizeof...(Venues);
+    static_assert(venue_count >= 2 && venue_count <= ConsolidatedBook::max_venues, "cross arbitrage needs 2 to 8 venues");
+
+    using VenueConfig = CrossVenueConfig;
+private:
+    template<class Venue>
+    class Lane {
+    private:
+        CrossArbitrage& engine;
+        size_t index;
+        Venue& exchange;
+        std::string symbol;
+        net::io_context io;
+        net::executor_work_guard<net::io_context::executor_type> work;
+        std::thread thread;
+        std::vector<std::string> ws_hosts;
+        std::vector<std::unique_ptr<FeedSupervisor>> feeds;
+        FeedArbiter arbiter;
+        OrderBook book;
+        BookSync book_sync;
+        DepthUpdate depth; // reused, so levels stop allocating once warmed up
+        int64_t leg_order_id = -1;
+        bool leg_is_buy{};
+        net::steady_timer leg_timer;
+        int64_t late_order_id = -1; // leg that timed out, its final update is still logged
+        bool late_is_buy{};
+        std::atomic<uint64_t> updates{0};
+    private:
+        void on_feed_message(size_t feed, rapidjson::Document& doc) {
+            uint64_t first_id, final_id;
+            if (feeds.size() > 1 && exchange.update_ids(doc, first_id, final_id) && !arbiter.accept(feed, FeedArbiter::make_key("depthUpdate", symbol), first_id, final_id))
+                return;
+            if (!exchange.parse_depth(doc, depth)) return;
+
+            // book is reloaded after start, reconnect or missed update
+            if (book_sync.apply(depth) != BookUpdateResult::applied) return;
+            updates.fetch_add(1, std::memory_order_relaxed);
+
+            int64_t start_ns = MessageTimes::now();
+            engine.consolidated.publish(index, book, depth.event_ms, start_ns);
+            engine.detect(start_ns);
+        }
+
+        void send_leg(bool is_buy, double quantity) {
+            leg_is_buy = is_buy;
+            OrderAck ack = exchange.new_market_order(symbol, is_buy, quantity, false);
+            if (ack.sent) engine.on_leg_sent(index, ack);
+            if (ack.order_id < 0) {
+                engine.on_leg_done(index, is_buy, OrderUpdate{ack.sent ? OrderState::rejected : OrderState::canceled, 0, 0, ""});
+                return;
+            }
+            leg_order_id = ack.order_id;
+            leg_timer.expires_after(leg_timeout);
+            leg_timer.async_wait([this](beast::error_code ec) {
+                if (ec || leg_order_id < 0) return;
+                late_order_id = leg_order_id;
+                late_is_buy = leg_is_buy;
+                leg_order_id = -1;
+                engine.on_leg_timeout(index, leg_is_buy);
+            });
+            poll_leg(); // fill may come before ack
+        }
+
+        void poll_leg() {
+            if (late_order_id >= 0) {
+                auto late = exchange.take_order_update(late_order_id);
+                if (late && late->is_final()) {
+                    late_order_id = -1;
+                    engine.on_late_leg(index, late_is_buy, *late);
+                }
+            }
+            if (leg_order_id < 0) return;
+            auto update = exchange.take_order_update(leg_order_id);
+            if (!update || !update->is_final()) return;
+            leg_order_id = -1;
+            leg_timer.cancel();
+            engine.on_leg_done(index, leg_is_buy, *update);
+        }
+
+    public:
+        Lane(CrossArbitrage& engine, size_t index, Venue& exchange, const VenueConfig& config, net::ssl::context& ssl) :
+                engine(engine),
+                index(index),
+                exchange(exchange),
+                symbol(config.symbol),
+                work(net::make_work_guard(io)),
+                ws_hosts(config.ws_hosts),
+                book(1000),
+                book_sync(io, book, [this](DepthUpdate& out) { return this->exchange.load_book(symbol, out); }),
+                leg_timer(io)
+        {
+            if (ws_hosts.empty() || ws_hosts.size() > FeedArbiter::max_feeds) throw std::runtime_error("Venue " + std::to_string(index) + " needs 1 to 8 websocket endpoints");
+            std::unordered_map<std::string, SymbolInfo> symbols;
+            exchange.load_symbols(symbols);
+            auto it = symbols.find(symbol);
+            if (it == symbols.end()) throw std::runtime_error("Symbol '" + symbol + "' is not listed on venue " + std::to_string(index));
+            engine.step_sizes[index] = it->second.step_size;
+            engine.consolidated.set_taker_fee(index, config.taker_fee);
+
+            exchange.watch_book(symbol, book);
+            exchange.set_order_callback([this]() { net::post(io, [this]() { poll_leg(); }); });
+            for (size_t i = 0; i < ws_hosts.size(); ++i) {
+                feeds.push_back(std::make_unique<FeedSupervisor>(io, ssl, ws_hosts[i], "/ws", [this, i](rapidjson::Document& doc, MessageTimes&) { on_feed_message(i, doc); }));
+                feeds.back()->subscribe(exchange.depth_stream(symbol));
+            }
+        }
+
+        Lane(const Lane&) = delete;
+        Lane& operator=(const Lane&) = delete;
+
+        ~Lane() {
+            if (!thread.joinable()) return;
+            io.stop();
+            thread.join();
+        }
+
+        void start() {
+            for (auto& feed : feeds) feed->start();
+            thread = std::thread([this]() {
+                Tracer::set_thread_name("venue " + std::to_string(index));
+                io.run();
+            });
+        }
+
+        // may be called from any thread
+        void post_leg(bool is_buy, double quantity) { net::post(io, [this, is_buy, quantity]() { send_leg(is_buy, quantity); }); }
+
+        void close() {
+            net::post(io, [this]() {
+                for (auto& feed : feeds) feed->close();
+                book_sync.cancel();
+                leg_timer.cancel();
+            });
+            work.reset();
+            if (thread.joinable()) thread.join();
+        }
+
+        void print_stats() const {
+            std::cout << "venue " << index << " " << symbol << ": book updates " << updates.load() << ", reloads " << book_sync.get_reloads() << " (" << book_sync.get_failed_reloads() << " failed)";
+            for (size_t i = 0; i < feeds.size(); ++i) std::cout << ", " << ws_hosts[i] << (feeds[i]->is_connected() ? " connected" : " disconnected") << " reconnects " << feeds[i]->get_reconnects();
+            std::cout << std::endl;
+        }
+    };
+
+    static constexpr std::chrono::seconds leg_timeout{10}; // leg without final update by then has unknown fill
+
+    ConsolidatedBook consolidated;
+    std::array<double, venue_count> step_sizes{};
+    double max_quantity;
+    double min_edge;
+    std::chrono::nanoseconds cooldown;
+    std::atomic<bool> in_flight{false};
+    std::atomic<bool> halted{false}; // inventory is off by an unknown or unhedged amount
+    std::atomic<int64_t> next_fire_ns{0};
+    LatencyHistogram detect_time; // publish to end of detection
+    std::atomic<uint64_t> detections{0};
+    std::atomic<uint64_t> opportunities{0};
+    // current cycle, written by lanes when their leg ends
+    std::mutex cycle_mutex;
+    int legs_pending{};
+    CrossOpportunity cycle{};
+    double bought{}, sold{}, cost{}, proceeds{};
+    bool leg_timed_out{}; // fill of one leg is unknown, so the cycle is never hedged
+    bool hedging{};
+    double hedge_quantity{};
+    uint64_t cycles{};
+    uint64_t hedges{};
+    double realized{};
+    std::string halt_reason;
+    std::ofstream& log_file;
+    std::tuple<std::unique_ptr<Lane<Venues>>...> lanes;
+private:
+    template<size_t... Is>
+    CrossArbitrage(std::index_sequence<Is...>, const std::array<VenueConfig, venue_count>& configs, net::ssl::context& ssl, double max_quantity, double min_edge, std::chrono::milliseconds cooldown, std::ofstream& log_file, Venues&... venues) :
+            consolidated(venue_count),
+            max_quantity(max_quantity),
+            min_edge(min_edge),
+            cooldown(cooldown),
+            log_file(log_file),
+            lanes(std::make_unique<Lane<Venues>>(*this, Is, venues, configs[Is], ssl)...)
+    { }
+
+    template<class F, size_t... Is>
+    void with_lane(size_t index, F& f, std::index_sequence<Is...>) { ((index == Is ? f(*std::get<Is>(lanes)) : void()), ...); }
+
+    template<class F>
+    void with_lane(size_t index, F&& f) { with_lane(index, f, std::index_sequence_for<Venues...>{}); }
+
+    template<class F>
+    void for_each_lane(F&& f) { std::apply([&](auto&... lane) { (f(*lane), ...); }, lanes); }
+
+    // called on lane thread after its venue book changed, no allocations
+    void detect(int64_t start_ns) {
+        if (in_flight.load(std::memory_order_acquire) || halted.load(std::memory_order_relaxed) || start_ns < next_fire_ns.load(std::memory_order_relaxed)) return;
+        std::array<BookSnapshot, venue_count> books;
+        for (size_t i = 0; i < venue_count; ++i)
+            if (!consolidated.read(i, books[i])) return;
+
+        CrossOpportunity best{};
+        bool found = false;
+        for (size_t buy = 0; buy < venue_count; ++buy) {
+            for (size_t sell = 0; sell < venue_count; ++sell) {
+                CrossOpportunity o{};
+                if (buy == sell || !ConsolidatedBook::find_cross(books[buy], books[sell], max_quantity, o)) continue;
+                if (found && o.profit <= best.profit) continue;
+                o.buy_venue = buy;
+                o.sell_venue = sell;
+                best = o;
+                found = true;
+            }
+        }
+        detections.fetch_add(1, std::memory_order_relaxed);
+        detect_time.record(static_cast<uint64_t>(MessageTimes::now() - start_ns));
+        if (!found || best.edge() < min_edge) return;
+        opportunities.fetch_add(1, std::memory_order_relaxed);
+        fire(best);
+    }
+
+    // quantity is rounded down to coarser step of the two venues
+    void fire(CrossOpportunity o) {
+        double step = std::max(step_sizes[o.buy_venue], step_sizes[o.sell_venue]);
+        if (step > 0) o.quantity = std::floor(o.quantity / step) * step;
+        if (o.quantity <= 0) return;
+        if (in_flight.exchange(true, std::memory_order_acq_rel)) return;
+        {
+            std::lock_guard<std::mutex> lock(cycle_mutex);
+            legs_pending = 2;
+            cycle = o;
+            bought = sold = cost = proceeds = 0;
+            leg_timed_out = false;
+        }
+        with_lane(o.buy_venue, [&](auto& lane) { lane.post_leg(true, o.quantity); });
+        with_lane(o.sell_venue, [&](auto& lane) { lane.post_leg(false, o.quantity); });
+    }
+
+    void on_leg_sent(size_t venue, const OrderAck& ack) {
+        std::lock_guard<std::mutex> lock(cycle_mutex);
+        std::cout << "venue " << venue << ": " << ack.raw << " in " << std::chrono::duration_cast<std::chrono::microseconds>(ack.round_trip).count() << "us" << std::endl;
+        log_file << ack.raw << ",\n\t";
+    }
+
+    // caller holds cycle_mutex
+    void halt(const std::string& reason) {
+        halt_reason = reason;
+        halted.store(true, std::memory_order_relaxed);
+        std::cout << "cross arbitrage halted: " << reason << std::endl;
+    }
+
+    // caller holds cycle_mutex
+    void finish_cycle() {
+        next_fire_ns.store(MessageTimes::now() + cooldown.count(), std::memory_order_relaxed);
+        in_flight.store(false, std::memory_order_release);
+    }
+
+    // caller holds cycle_mutex, excess is flattened on the venue that filled more, remainder below its step is left
+    // after a leg timed out nothing is sent, known fills are printed for manual reconciliation
+    void settle_legs() {
+        if (leg_timed_out) {
+            std::cout << "legs filled " << bought << " and " << sold << " with a leg of unknown fill, not hedged, reconcile venue "
+                      << cycle.buy_venue << " and " << cycle.sell_venue << " manually" << std::endl;
+            return finish_cycle();
+        }
+        double excess = bought - sold;
+        size_t venue = excess > 0 ? cycle.buy_venue : cycle.sell_venue;
+        double step = step_sizes[venue];
+        double quantity = step > 0 ? std::floor(std::abs(excess) / step) * step : std::abs(excess);
+        if (quantity <= 0) return finish_cycle();
+        hedging = true;
+        hedge_quantity = quantity;
+        hedges++;
+        std::cout << "legs filled " << bought << " and " << sold << ", " << (excess > 0 ? "selling " : "buying ") << quantity << " on venue " << venue << std::endl;
+        with_lane(venue, [&](auto& lane) { lane.post_leg(excess < 0, quantity); });
+    }
+
+    void on_leg_done(size_t venue, bool is_buy, const OrderUpdate& update) {
+        std::lock_guard<std::mutex> lock(cycle_mutex);
+        std::cout << "venue " << venue << (is_buy ? ": bought " : ": sold ") << update.executed << " (" << update.cum_quote << "), " << update.state << std::endl;
+        if (!update.report.empty()) log_file << update.report << ",\n\t";
+        if (hedging) {
+            hedging = false;
+            realized += is_buy ? -update.cum_quote : update.cum_quote;
+            double left = hedge_quantity - update.executed;
+            if (left > 0 && left >= step_sizes[venue]) halt(std::to_string(left) + " left unhedged on venue " + std::to_string(venue));
+            return finish_cycle();
+        }
+        (is_buy ? bought : sold) = update.executed;
+        (is_buy ? cost : proceeds) = update.cum_quote;
+        if (--legs_pending > 0) return;
+
+        cycles++;
+        if (!leg_timed_out) {
+            realized += proceeds - cost;
+            std::cout << "cycle " << cycles << ": expected profit " << cycle.profit << " (" << cycle.edge() * 100 << "%), got " << proceeds - cost << " before fees" << std::endl;
+        }
+        settle_legs();
+    }
+
+    // leg without final update has unknown fill, so it can't be hedged; other leg still finishes the cycle
+    void on_leg_timeout(size_t venue, bool is_buy) {
+        std::lock_guard<std::mutex> lock(cycle_mutex);
+        halt(std::string(is_buy ? "buy" : "sell") + " on venue " + std::to_string(venue) + " got no final update in " + std::to_string(leg_timeout.count()) + "s");
+        if (hedging) {
+            hedging = false;
+            return finish_cycle();
+        }
+        leg_timed_out = true;
+        if (--legs_pending > 0) return;
+        cycles++;
+        settle_legs();
+    }
+
+    // final update of a leg that timed out, engine stays halted, it is only logged
+    void on_late_leg(size_t venue, bool is_buy, const OrderUpdate& update) {
+        std::lock_guard<std::mutex> lock(cycle_mutex);
+        std::cout << "venue " << venue << (is_buy ? ": late buy " : ": late sell ") << update.executed << " (" << update.cum_quote << "), " << update.state << std::endl;
+        if (!update.report.empty()) log_file << update.report << ",\n\t";
+    }
+
+public:
+    // venues must outlive engine and are closed after it
+    CrossArbitrage(const std::array<VenueConfig, venue_count>& configs, net::ssl::context& ssl, double max_quantity, double min_edge, std::chrono::milliseconds cooldown, std::ofstream& log_file, Venues&... venues) :
+            CrossArbitrage(std::index_sequence_for<Venues...>{}, configs, ssl, max_quantity, min_edge, cooldown, log_file, venues...)
+    { }
+
+    CrossArbitrage(const CrossArbitrage&) = delete;
+    CrossArbitrage& operator=(const CrossArbitrage&) = delete;
+
+    void start() { for_each_lane([](auto& lane) { lane.start(); }); }
+
+    // may be called from any thread
+    void print_stats() {
+        for_each_lane([](auto& lane) { lane.print_stats(); });
+        std::cout << std::fixed << std::setprecision(1)
+                  << "detections " << detections.load() << ", opportunities " << opportunities.load()
+                  << ", detect time (us) p50: " << static_cast<double>(detect_time.percentile(0.5)) / 1000
+                  << " p99: " << static_cast<double>(detect_time.percentile(0.99)) / 1000
+                  << " max: " << static_cast<double>(detect_time.get_max()) / 1000 << std::endl;
+        std::cout.unsetf(std::ios_base::floatfield);
+        {
+            std::lock_guard<std::mutex> lock(cycle_mutex);
+            std::cout << "cycles " << cycles << ", hedges " << hedges << ", realized " << realized << " before fees";
+            if (halted.load(std::memory_order_relaxed)) std::cout << ", halted: " << halt_reason;
+            std::cout << std::endl;
+        }
+
+        // consolidated top, fee adjusted, once every venue has a book
+        std::array<BookSnapshot, venue_count> books{};
+        for (size_t i = 0; i < venue_count; ++i)
+            if (!consolidated.read(i, books[i])) return;
+        std::array<VenueLevel, 5> levels{};
+        for (bool bids : {true, false}) {
+            size_t n = ConsolidatedBook::merge(books.data(), venue_count, bids, levels.data(), levels.size());
+            std::cout << (bids ? "bids:" : "asks:");
+            for (size_t i = 0; i < n; ++i) std::cout << " " << levels[i].price << " x " << levels[i].quantity << " @" << levels[i].venue;
+            std::cout << std::endl;
+        }
+    }
+
+    // stops lanes, legs in flight are left to venues
+    void close() {
+        for_each_lane([](auto& lane) { lane.close(); });
+        print_stats();
+    }
+
+    [[maybe_unused]] const ConsolidatedBook& get_book() const { return consolidated; }
+};
+
+
+#endif //ARB_CROSS_ARBITRAGE_H
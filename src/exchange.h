@@ -0,0 +1,93 @@
+#ifndef ARB_EXCHANGE_H
+#define ARB_EXCHANGE_H
+
+#include <cinttypes>
+#include <string>
+#include <chrono>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include "../include/rapidjson/document.h"
+#include "order_book.h"
+#include "bars.h"
+#include "positions.h"
+#include "rate_limit.h"
+#include "book_sync.h"
+
+struct SymbolInfo {
+public:
+    double step_size; // quantity step
+};
+
+struct OrderAck {
+public:
+    bool sent{};                            // false when venue refused to send it, for example because of rate limit
+    int64_t order_id = -1;                  // -1 if order was rejected
+    int64_t transact_ms{};                  // venue time of acceptance, 0 if unknown
+    std::chrono::nanoseconds round_trip{};
+    int64_t response_rx_ns{};               // kernel receive time of response, 0 if unknown
+    std::string raw;                        // venue response, for the log
+};
+
+struct OrderUpdate {
+public:
+    OrderState state;
+    double executed;
+    double cum_quote;
+    std::string report; // raw venue report, for the log
+
+    [[nodiscard]] bool is_final() const { return state == OrderState::filled || state == OrderState::rejected || state == OrderState::canceled; }
+};
+
+// venue interface, resolved at compile time: strategy is a template over the adapter, so the hot path
+// has no virtual calls and adapter methods can be inlined
+// adapter derives from Exchange<Adapter> and implements the *_impl methods, ones with a body here are optional
+//
+// market data: stream names for websocket feeds, venue messages normalized into DepthUpdate and Trade
+// order entry: market orders, fills are taken by order id once the order callback fires
+// metadata: symbol filters, venue clock offset and rate limits
+template<class Venue>
+class Exchange {
+private:
+    Venue& venue() { return static_cast<Venue&>(*this); }
+    const Venue& venue() const { return static_cast<const Venue&>(*this); }
+protected:
+    Exchange() = default;
+
+    void watch_book_impl(const std::string&, const OrderBook&) { }
+    [[nodiscard]] int64_t get_clock_offset_us_impl() const { return 0; }
+    [[nodiscard]] const RateLimiter* get_rate_limiter_impl() const { return nullptr; }
+    void close_impl() { }
+public:
+    Exchange(const Exchange&) = delete;
+    Exchange& operator=(const Exchange&) = delete;
+
+    // market data, may be called from feed thread
+    [[nodiscard]] std::string depth_stream(const std::string& symbol) const { return venue().depth_stream_impl(symbol); }
+    bool update_ids(const rapidjson::Value& event, uint64_t& first_id, uint64_t& final_id) const { return venue().update_ids_impl(event, first_id, final_id); }
+    bool parse_depth(const rapidjson::Value& event, DepthUpdate& out) const { return venue().parse_depth_impl(event, out); }
+    // aggregate trades by default, every single trade otherwise
+    [[nodiscard]] std::string trade_stream(const std::string& symbol, bool aggregate) const { return venue().trade_stream_impl(symbol, aggregate); }
+    bool parse_trade(const rapidjson::Value& event, Trade& out) const { return venue().parse_trade_impl(event, out); }
+
+    // full book, used after start and when diffs have a gap; doesn't wait for rate limits, see BookLoad
+    BookLoad load_book(const std::string& symbol, DepthUpdate& out) { return venue().load_book_impl(symbol, out); }
+    // book strategy keeps for the symbol, lives as long as the strategy
+    void watch_book(const std::string& symbol, const OrderBook& book) { venue().watch_book_impl(symbol, book); }
+
+    // order entry, called on strategy thread
+    OrderAck new_market_order(const std::string& symbol, bool is_buy, double quantity, bool quote_quantity) { return venue().new_market_order_impl(symbol, is_buy, quantity, quote_quantity); }
+    std::optional<OrderUpdate> take_order_update(int64_t order_id) { return venue().take_order_update_impl(order_id); }
+    // callback may fire on any thread when fills are ready to be taken
+    void set_order_callback(std::function<void()> callback) { venue().set_order_callback_impl(std::move(callback)); }
+
+    // metadata
+    void load_symbols(std::unordered_map<std::string, SymbolInfo>& out) { venue().load_symbols_impl(out); }
+    [[nodiscard]] int64_t get_clock_offset_us() const { return venue().get_clock_offset_us_impl(); }
+    [[nodiscard]] const RateLimiter* get_rate_limiter() const { return venue().get_rate_limiter_impl(); }
+
+    void close() { venue().close_impl(); }
+};
+
+
+#endif //ARB_EXCHANGE_H
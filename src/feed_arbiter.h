@@ -0,0 +1,86 @@
+#ifndef ARB_FEED_ARBITER_H
+#define ARB_FEED_ARBITER_H
+
+#include <cinttypes>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <string_view>
+#include <functional>
+
+// A/B line arbitration between redundant feeds of the same streams
+// first copy of every update id is passed through, later copies from other feeds are dropped
+// state is a fixed open addressing table of atomics, so feeds may call accept() from their own threads
+class FeedArbiter {
+public:
+    static constexpr size_t max_feeds = 8;
+    static constexpr size_t table_size = 1024; // power of two
+
+    struct FeedStats {
+    public:
+        std::atomic<uint64_t> wins{0};
+        std::atomic<uint64_t> duplicates{0};
+        std::atomic<uint64_t> gaps{0};    // first arrival skipped some ids
+        std::atomic<int64_t> lead_ns{0};  // sum of time this feed was ahead of the duplicate
+    };
+private:
+    struct Slot {
+    public:
+        std::atomic<uint64_t> key{0};
+        std::atomic<uint64_t> last_id{0};
+        std::atomic<int64_t> win_time{0};
+        std::atomic<uint32_t> winner{0};
+    };
+
+    std::array<Slot, table_size> slots;
+    std::array<FeedStats, max_feeds> stats;
+private:
+    static int64_t now_ns() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+    // slots are never freed, table only has to fit all streams of the process
+    Slot* find(uint64_t key) {
+        for (size_t i = 0; i < table_size; ++i) {
+            Slot& s = slots[(key + i) & (table_size - 1)];
+            uint64_t k = s.key.load(std::memory_order_acquire);
+            if (k == key) return &s;
+            if (k == 0 && s.key.compare_exchange_strong(k, key, std::memory_order_acq_rel)) return &s;
+            if (k == key) return &s; // other feed took this slot for same key
+        }
+        return nullptr;
+    }
+
+public:
+    // key is a stream of comparable ids, for example event type and symbol
+    static uint64_t make_key(std::string_view event, std::string_view symbol) {
+        uint64_t key = std::hash<std::string_view>()(event) * 31 + std::hash<std::string_view>()(symbol);
+        return key == 0 ? 1 : key;
+    }
+
+    // returns true if event should be processed
+    bool accept(size_t feed, uint64_t key, uint64_t first_id, uint64_t final_id) {
+        Slot* s = find(key);
+        if (!s) return true; // table is full, pass everything rather than lose data
+
+        uint64_t last = s->last_id.load(std::memory_order_acquire);
+        while (final_id > last) {
+            if (!s->last_id.compare_exchange_weak(last, final_id, std::memory_order_acq_rel, std::memory_order_acquire)) continue;
+            s->win_time.store(now_ns(), std::memory_order_relaxed);
+            s->winner.store(static_cast<uint32_t>(feed), std::memory_order_relaxed);
+            stats[feed].wins.fetch_add(1, std::memory_order_relaxed);
+            if (last != 0 && first_id > last + 1) stats[feed].gaps.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        stats[feed].duplicates.fetch_add(1, std::memory_order_relaxed);
+        if (final_id == last) {
+            uint32_t winner = s->winner.load(std::memory_order_relaxed);
+            if (winner != feed) stats[winner].lead_ns.fetch_add(now_ns() - s->win_time.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        return false;
+    }
+
+    [[nodiscard]] const FeedStats& get_stats(size_t feed) const { return stats[feed]; }
+};
+
+
+#endif //ARB_FEED_ARBITER_H
@@ -0,0 +1,172 @@
+#ifndef ARB_FEED_HANDLER_H
+#define ARB_FEED_HANDLER_H
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include "../include/rapidjson/document.h"
+#include "web.h"
+#include "order_book.h"
+#include "feed_supervisor.h"
+#include "subscription_manager.h"
+#include "feed_arbiter.h"
+#include "book_sync.h"
+#include "telemetry.h"
+#include "binance.h"
+
+// feed handler process: keeps books of many symbols from exchange websockets and publishes
+// top of every changed book to sinks (shared memory bus, multicast), so strategies on the host
+// or network don't need their own exchange connections, tls and json parsing
+// symbols can be added and removed while running, streams of every endpoint are spread over as many
+// connections as needed
+// everything runs on one io thread
+class FeedHandler {
+public:
+    using Sink = std::function<void(const BookSnapshot&)>;
+private:
+    struct SymbolBook {
+    public:
+        OrderBook book{1000};
+        BookSync sync;
+
+        SymbolBook(net::io_context& io, BookSync::Loader loader) : sync(io, book, std::move(loader)) { }
+    };
+
+    net::io_context& io;
+    RateLimiter rate_limiter;
+    RestApi rest_api;
+    std::vector<std::string> ws_hosts;
+    std::vector<std::unique_ptr<SubscriptionManager>> feeds; // same streams from every endpoint
+    FeedArbiter arbiter;
+    std::unordered_map<std::string, std::unique_ptr<SymbolBook>> books; // pointers, so pending reloads keep their book
+    std::unordered_set<std::string> universe; // symbols added by set_universe, others were asked for by hand
+    std::vector<Sink> sinks;
+    BookSnapshot snapshot{};
+    DepthUpdate depth;
+    uint64_t published{};
+    uint64_t reloads{};
+private:
+    void on_feed_message(size_t feed, rapidjson::Document& doc) {
+        if (!BinanceExchange::parse_depth_event(doc, depth)) return;
+        if (feeds.size() > 1 && !arbiter.accept(feed, FeedArbiter::make_key("depthUpdate", doc["s"].GetString()), depth.first_id, depth.final_id))
+            return;
+
+        std::string symbol = doc["s"].GetString();
+        auto it = books.find(symbol);
+        if (it == books.end()) return;
+        OrderBook& book = it->second->book;
+
+        // book is reloaded after start, reconnect or missed update
+        if (it->second->sync.apply(depth) != BookUpdateResult::applied) return;
+
+        snapshot.set_symbol(symbol);
+        book.make_snapshot(snapshot);
+        snapshot.exchange_ms = depth.event_ms;
+        snapshot.publish_ns = MessageTimes::now();
+        for (auto& sink : sinks) sink(snapshot);
+        published++;
+    }
+
+    BookLoad load_book_snapshot(const std::string& symbol, DepthUpdate& out) {
+        BookLoad load;
+        load.retry_after = std::chrono::nanoseconds(rate_limiter.acquire_or_wait(RequestPriority::info, BinanceExchange::depth_weight));
+        if (load.retry_after.count() > 0) return load;
+        auto result = rest_api.get("/api/v3/depth", "symbol=" + symbol + "&limit=1000", false);
+        rapidjson::Document doc;
+        doc.Parse(result.second.body().c_str());
+        load.loaded = BinanceExchange::parse_depth_snapshot(doc, out);
+        if (!load.loaded) std::cout << BinanceResult{doc["code"].GetInt(), doc["msg"].GetString()} << std::endl;
+        else reloads++;
+        return load;
+    }
+
+public:
+    FeedHandler(const std::vector<std::string>& symbols, const std::string& rest_host, std::vector<std::string> ws_hosts, net::io_context& io, net::ssl::context& ssl, size_t streams_per_connection = FeedSupervisor::max_streams) :
+            io(io),
+            rest_api(BinanceRestApi(rest_host, "", "", io, ssl)),
+            ws_hosts(std::move(ws_hosts))
+    {
+        if (this->ws_hosts.size() > FeedArbiter::max_feeds) throw std::runtime_error("Too many websocket endpoints");
+        rest_api.set_rate_limiter(&rate_limiter);
+        for (size_t i = 0; i < this->ws_hosts.size(); ++i)
+            feeds.push_back(std::make_unique<SubscriptionManager>(io, ssl, this->ws_hosts[i], "/ws", [this, i](rapidjson::Document& doc, MessageTimes&) { on_feed_message(i, doc); }, streams_per_connection));
+
+        for (auto& s : symbols) {
+            if (s.size() >= BookSnapshot::symbol_size) throw std::runtime_error("Symbol '" + s + "' is too long");
+            add_symbol(s);
+        }
+    }
+
+    FeedHandler(const FeedHandler&) = delete;
+    FeedHandler& operator=(const FeedHandler&) = delete;
+
+    // sinks are called on io thread for every changed book
+    void add_sink(Sink sink) { sinks.push_back(std::move(sink)); }
+
+    void start() {
+        for (auto& feed : feeds) feed->start();
+    }
+
+    // book is loaded from snapshot with the first diff, false if symbol is already published
+    bool add_symbol(const std::string& symbol) {
+        if (symbol.size() >= BookSnapshot::symbol_size || books.count(symbol)) return false;
+        books.emplace(symbol, std::make_unique<SymbolBook>(io, [this, symbol](DepthUpdate& out) { return load_book_snapshot(symbol, out); }));
+        for (auto& feed : feeds) feed->subscribe(BinanceExchange::depth_stream_name(symbol));
+        return true;
+    }
+
+    // subscribers just stop getting updates of the symbol
+    bool remove_symbol(const std::string& symbol) {
+        if (!books.erase(symbol)) return false;
+        universe.erase(symbol);
+        for (auto& feed : feeds) feed->unsubscribe(BinanceExchange::depth_stream_name(symbol));
+        return true;
+    }
+
+    // publishes exactly these symbols besides ones added by hand, for candidates of universe scanner
+    void set_universe(const std::vector<std::string>& symbols) {
+        std::unordered_set<std::string> wanted(symbols.begin(), symbols.end());
+        std::vector<std::string> stale;
+        for (auto& s : universe) if (!wanted.count(s)) stale.push_back(s);
+        for (auto& s : stale) {
+            remove_symbol(s);
+            std::cout << "universe: removed " << s << std::endl;
+        }
+        for (auto& s : symbols) {
+            if (!add_symbol(s)) continue;
+            universe.insert(s);
+            std::cout << "universe: added " << s << std::endl;
+        }
+    }
+
+    void rebalance() {
+        for (auto& feed : feeds) std::cout << feed->get_host() << ": moved " << feed->rebalance() << " streams" << std::endl;
+    }
+
+    void print_subscriptions() {
+        for (auto& feed : feeds) feed->print_subscriptions();
+    }
+
+    void print_stats() const {
+        std::cout << "published " << published << " book updates of " << books.size() << " symbols, " << reloads << " snapshot reloads" << std::endl;
+        for (size_t i = 0; i < feeds.size(); ++i)
+            std::cout << "feed " << ws_hosts[i] << ": " << feeds[i]->stream_count() << " streams on " << feeds[i]->connection_count() << " connections, reconnects " << feeds[i]->get_reconnects() << (feeds[i]->is_connected() ? ", connected" : ", disconnected") << std::endl;
+    }
+
+    // must be called on io thread, io.run() returns once everything is closed
+    void close() {
+        for (auto& feed : feeds) feed->close();
+        for (auto& [symbol, b] : books) b->sync.cancel();
+        print_stats();
+        rest_api.close();
+    }
+};
+
+
+#endif //ARB_FEED_HANDLER_H
@@ -0,0 +1,422 @@
+#ifndef ARB_FEED_SUPERVISOR_H
+#define ARB_FEED_SUPERVISOR_H
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <deque>
+#include <cstring>
+#include <algorithm>
+#include "../include/rapidjson/document.h"
+#include "web.h"
+#include "telemetry.h"
+#include "perf_counters.h"
+#include "tracer.h"
+
+// update id range of market data event, false for events without one
+// ids are only comparable within the same event type and symbol
+inline bool get_update_ids(const rapidjson::Value& doc, uint64_t& first_id, uint64_t& final_id) {
+    if (!doc.HasMember("s")) return false;
+    if (doc.HasMember("U") && doc.HasMember("u")) { // diff depth
+        first_id = doc["U"].GetUint64();
+        final_id = doc["u"].GetUint64();
+        return true;
+    }
+    if (doc.HasMember("u")) { // book ticker
+        first_id = final_id = doc["u"].GetUint64();
+        return true;
+    }
+    if (!doc.HasMember("e")) return false;
+    const char* type = doc["e"].GetString();
+    const char* id = strcmp(type, "aggTrade") == 0 ? "a" : strcmp(type, "trade") == 0 ? "t" : nullptr;
+    if (!id || !doc.HasMember(id)) return false;
+    first_id = final_id = doc[id].GetUint64(); // trade or aggregate trade
+    return true;
+}
+
+// keeps websocket market data alive: reconnects after failures and replaces connection before
+// exchange drops it (binance closes every connection after 24 hours)
+// replacement is opened and subscribed while old one still works, depth events of both are lined up
+// by update id, so consumer sees every id once and in order
+// subscription requests go through a queue per connection: binance allows 5 incoming messages per second
+// (pings and pongs included) and 1024 streams per connection, replies are matched to requests by id
+// and every new connection checks its streams with LIST_SUBSCRIPTIONS once subscribed
+// everything except stats getters must be called on io thread of the supervisor
+class FeedSupervisor {
+public:
+    using MessageHandler = std::function<void(rapidjson::Document&, MessageTimes&)>;
+    using ListHandler = std::function<void(const std::vector<std::string>&)>;
+    using SubscribedHandler = std::function<void(bool)>; // false if exchange refused the subscription
+    static constexpr size_t max_streams = 1024;
+private:
+    struct Request {
+    public:
+        const char* method;
+        std::vector<std::string> streams;
+        ListHandler on_list; // LIST_SUBSCRIPTIONS only
+    };
+
+    struct Connection {
+    public:
+        BinanceWebSockets ws;
+        bool ready{};
+        std::unordered_set<std::string> aligned; // streams on which this connection caught up with forwarded ids
+        PerfCounters::Sample read_start{};
+        bool read_measured{};
+        uint64_t read_begin{}; // trace ticks, 0 when tracing is off
+        std::deque<Request> queue;
+        std::unordered_map<uint64_t, Request> sent; // waiting for reply, by request id
+        net::steady_timer pace_timer;
+        std::chrono::steady_clock::time_point next_send{};
+        bool pacing{};
+
+        Connection(net::io_context& io, net::ssl::context& ssl) : ws(io, ssl), pace_timer(io) { }
+    };
+
+    static constexpr std::chrono::seconds max_reconnect_delay{30};
+    static constexpr std::chrono::seconds ping_interval{15};
+    static constexpr std::chrono::milliseconds request_interval{250}; // 4 per second, one left for ping and pong
+    static constexpr size_t max_streams_per_request = 100;
+
+    net::io_context& io;
+    net::ssl::context& ssl;
+    std::string host;
+    std::string target;
+    std::chrono::seconds rotate_after;
+    std::vector<std::string> streams;
+    // handlers keep their connection alive, so closed connection lives until its last handler is done
+    std::shared_ptr<Connection> active;
+    std::shared_ptr<Connection> standby;
+    net::steady_timer rotate_timer;
+    net::steady_timer reconnect_timer;
+    net::steady_timer ping_timer;
+    std::chrono::seconds reconnect_delay{1};
+    PingStats ping_stats;
+    std::unordered_map<std::string, uint64_t> last_update_ids;
+    std::unordered_map<std::string, SubscribedHandler> pending_subscribed; // by stream, first SUBSCRIBE reply carrying it calls it
+    MessageHandler handler;
+    uint64_t next_request_id = 1;
+    std::atomic<uint64_t> reconnects{0};
+    std::atomic<bool> connected{false};
+    bool rx_timestamps{};
+    bool closed{};
+private:
+    void open_connection() {
+        auto c = std::make_shared<Connection>(io, ssl);
+        c->ws.set_ping_stats(&ping_stats);
+        c->ws.set_rx_timestamps(rx_timestamps);
+        standby = c;
+        c->ws.async_connect(host, target, [this, c](beast::error_code ec) { on_connected(c, ec); });
+    }
+
+    void on_connected(const std::shared_ptr<Connection>& c, beast::error_code ec) {
+        if (closed || c != standby) return;
+        if (ec) {
+            std::cout << "market data connect: " << ec.message() << std::endl;
+            standby.reset();
+            schedule_reconnect();
+            return;
+        }
+
+        c->ready = true;
+        for (size_t i = 0; i < streams.size(); i += max_streams_per_request)
+            enqueue(c, "SUBSCRIBE", std::vector<std::string>(streams.begin() + static_cast<std::ptrdiff_t>(i), streams.begin() + static_cast<std::ptrdiff_t>(std::min(streams.size(), i + max_streams_per_request))));
+        enqueue(c, "LIST_SUBSCRIPTIONS", {}, [this, c](const std::vector<std::string>& list) { reconcile(c, list); });
+        read(c);
+        if (!active) promote(); // nothing to line up with
+    }
+
+    // next read is started after message is handled, so its counters only cover reading
+    void read(const std::shared_ptr<Connection>& c) {
+        c->read_measured = PerfRegion::begin(c->read_start);
+        c->read_begin = Tracer::is_enabled() ? Tracer::now() : 0;
+        c->ws.async_read([this, c](beast::error_code ec, size_t) {
+            if (ec) return on_lost(c, ec);
+            if (c->read_measured) perf_regions.ws_read.end(c->read_start);
+            if (c->read_begin) Tracer::record("ws_read", c->read_begin, Tracer::now());
+            MessageTimes times;
+            times.local_rx_ns = MessageTimes::now();
+            const RxTimestamp& rx = c->ws.get_rx_timestamp();
+            times.kernel_rx_ns = rx.software_ns;
+            times.nic_rx_ns = rx.hardware_ns;
+            std::string msg = c->ws.read_str_from_buffer();
+            on_message(c, msg, times);
+            read(c);
+        });
+    }
+
+    void on_message(const std::shared_ptr<Connection>& c, const std::string& msg, MessageTimes& times) {
+        rapidjson::Document doc;
+        {
+            PerfScope scope(perf_regions.json_parse);
+            TraceScope trace("json_parse");
+            doc.Parse(msg.c_str());
+        }
+        times.parsed_ns = MessageTimes::now();
+        // all market streams ('!miniTicker@arr') send arrays, they have no ids and each replaces the previous one
+        if (doc.IsArray()) {
+            if (c == active) handler(doc, times);
+            return;
+        }
+        if (!doc.IsObject()) return;
+        if (doc.HasMember("E")) times.exchange_ms = doc["E"].GetInt64();
+
+        if (doc.HasMember("id")) return on_reply(c, doc);
+
+        bool from_active = c == active;
+        uint64_t first_id, final_id;
+        if (!get_update_ids(doc, first_id, final_id)) {
+            if (from_active) handler(doc, times);
+            return;
+        }
+
+        std::string key = doc["s"].GetString();
+        if (doc.HasMember("e")) key += doc["e"].GetString();
+        uint64_t& last_id = last_update_ids[key];
+
+        if (final_id <= last_id) { // already forwarded from other connection
+            if (!from_active) align(c, key);
+            return;
+        }
+        // replacement is ahead of active connection, active one will deliver missing ids first
+        if (!from_active && first_id > last_id + 1) return;
+
+        last_id = final_id;
+        handler(doc, times);
+        if (!from_active) align(c, key);
+    }
+
+    void align(const std::shared_ptr<Connection>& c, const std::string& key) {
+        if (c != standby) return;
+        c->aligned.insert(key);
+        if (c->aligned.size() >= last_update_ids.size()) promote();
+    }
+
+    void promote() {
+        auto old = std::move(active);
+        active = std::move(standby);
+        active->aligned.clear();
+        connected = true;
+        reconnect_delay = std::chrono::seconds(1);
+        if (old) old->ws.async_close([old](beast::error_code) { });
+        schedule_rotation();
+    }
+
+    void on_lost(const std::shared_ptr<Connection>& c, beast::error_code ec) {
+        if (closed || (c != active && c != standby)) return;
+        std::cout << "market data connection lost: " << ec.message() << std::endl;
+
+        if (c == standby) {
+            standby.reset();
+            schedule_reconnect();
+            return;
+        }
+
+        reconnects++;
+        active.reset();
+        connected = false;
+        if (standby && standby->ready) promote();
+        else if (!standby) schedule_reconnect();
+    }
+
+    void schedule_reconnect() {
+        reconnect_timer.expires_after(reconnect_delay);
+        reconnect_timer.async_wait([this](beast::error_code ec) {
+            if (ec || closed || standby) return;
+            open_connection();
+        });
+        reconnect_delay = std::min(reconnect_delay * 2, max_reconnect_delay);
+    }
+
+    void schedule_rotation() {
+        rotate_timer.expires_after(rotate_after);
+        rotate_timer.async_wait([this](beast::error_code ec) {
+            if (ec || closed || standby) return;
+            open_connection();
+        });
+    }
+
+    void schedule_ping() {
+        ping_timer.expires_after(ping_interval);
+        ping_timer.async_wait([this](beast::error_code ec) {
+            if (ec || closed) return;
+            if (active) active->ws.async_ping();
+            schedule_ping();
+        });
+    }
+
+    // consecutive requests of the same method are merged while they wait
+    void enqueue(const std::shared_ptr<Connection>& c, const char* method, std::vector<std::string> list, ListHandler on_list = {}) {
+        if (!on_list && list.empty()) return;
+        Request* last = c->queue.empty() ? nullptr : &c->queue.back();
+        if (!on_list && last && !last->on_list && strcmp(last->method, method) == 0 && last->streams.size() + list.size() <= max_streams_per_request)
+            last->streams.insert(last->streams.end(), list.begin(), list.end());
+        else c->queue.push_back(Request{method, std::move(list), std::move(on_list)});
+        flush(c);
+    }
+
+    void flush(const std::shared_ptr<Connection>& c) {
+        if (!c->ready || c->pacing || c->queue.empty()) return;
+        auto now = std::chrono::steady_clock::now();
+        if (now < c->next_send) {
+            c->pacing = true;
+            c->pace_timer.expires_at(c->next_send);
+            c->pace_timer.async_wait([this, c](beast::error_code ec) {
+                c->pacing = false;
+                if (ec || closed || (c != active && c != standby)) return;
+                flush(c);
+            });
+            return;
+        }
+
+        Request r = std::move(c->queue.front());
+        c->queue.pop_front();
+        uint64_t id = next_request_id++;
+        std::string msg = std::string("{\"method\": \"") + r.method + "\"";
+        if (!r.on_list) {
+            msg += ", \"params\": [";
+            for (size_t i = 0; i < r.streams.size(); ++i) msg += (i > 0 ? ",\"" : "\"") + r.streams[i] + "\"";
+            msg += "]";
+        }
+        msg += ", \"id\": " + std::to_string(id) + "}";
+        c->ws.send(std::move(msg));
+        c->sent.emplace(id, std::move(r));
+        c->next_send = now + request_interval;
+        flush(c);
+    }
+
+    void on_reply(const std::shared_ptr<Connection>& c, const rapidjson::Document& doc) {
+        if (!doc["id"].IsUint64()) return;
+        auto it = c->sent.find(doc["id"].GetUint64());
+        if (it == c->sent.end()) return;
+        Request r = std::move(it->second);
+        c->sent.erase(it);
+
+        const rapidjson::Value* error = doc.HasMember("error") ? &doc["error"] : doc.HasMember("code") ? &doc : nullptr;
+        if (strcmp(r.method, "SUBSCRIBE") == 0 && !pending_subscribed.empty() && (c == active || c == standby)) {
+            for (auto& stream : r.streams) {
+                auto confirm = pending_subscribed.find(stream);
+                if (confirm == pending_subscribed.end()) continue;
+                SubscribedHandler on_subscribed = std::move(confirm->second);
+                pending_subscribed.erase(confirm); // handler may subscribe or unsubscribe
+                on_subscribed(error == nullptr);
+            }
+        }
+        if (error) {
+            std::cout << r.method << " " << r.streams.size() << " streams on " << host << ": " << BinanceResult{(*error)["code"].GetInt(), (*error)["msg"].GetString()} << std::endl;
+            return;
+        }
+        if (!r.on_list || !doc.HasMember("result") || !doc["result"].IsArray()) return;
+        std::vector<std::string> list;
+        for (auto& v : doc["result"].GetArray()) list.emplace_back(v.GetString());
+        r.on_list(list);
+    }
+
+    // connection subscribed on exchange side must match wanted streams
+    void reconcile(const std::shared_ptr<Connection>& c, const std::vector<std::string>& list) {
+        if (c != active && c != standby) return;
+        std::unordered_set<std::string> have(list.begin(), list.end());
+        std::vector<std::string> missing, extra;
+        for (auto& s : streams) if (!have.erase(s)) missing.push_back(s);
+        extra.assign(have.begin(), have.end());
+        if (missing.empty() && extra.empty()) return;
+        std::cout << host << ": " << missing.size() << " streams missing, " << extra.size() << " extra, fixing" << std::endl;
+        enqueue(c, "SUBSCRIBE", std::move(missing));
+        enqueue(c, "UNSUBSCRIBE", std::move(extra));
+    }
+
+    // ids of events of unsubscribed symbol must not hold back promotion of replacement connection
+    void forget_symbol(const std::string& stream) {
+        std::string symbol = stream.substr(0, stream.find('@'));
+        std::transform(symbol.begin(), symbol.end(), symbol.begin(), [](unsigned char ch){ return std::toupper(ch); });
+        auto matches = [&](const std::string& key) {
+            return key.size() > symbol.size() && key.compare(0, symbol.size(), symbol) == 0 && std::islower(static_cast<unsigned char>(key[symbol.size()]));
+        };
+        for (auto it = last_update_ids.begin(); it != last_update_ids.end();) it = matches(it->first) ? last_update_ids.erase(it) : std::next(it);
+        if (standby)
+            for (auto it = standby->aligned.begin(); it != standby->aligned.end();) it = matches(*it) ? standby->aligned.erase(it) : std::next(it);
+    }
+
+public:
+    FeedSupervisor(net::io_context& io, net::ssl::context& ssl, std::string host, std::string target, MessageHandler handler, std::chrono::seconds rotate_after = std::chrono::hours(23)) :
+            io(io),
+            ssl(ssl),
+            host(std::move(host)),
+            target(std::move(target)),
+            rotate_after(rotate_after),
+            rotate_timer(io),
+            reconnect_timer(io),
+            ping_timer(io),
+            handler(std::move(handler))
+    { }
+
+    FeedSupervisor(const FeedSupervisor&) = delete;
+    FeedSupervisor& operator=(const FeedSupervisor&) = delete;
+
+    void start() {
+        open_connection();
+        schedule_ping();
+    }
+
+    // kernel receive timestamps for connections opened after this call
+    void set_rx_timestamps(bool enable) { rx_timestamps = enable; }
+
+    // stream is sent again on every new connection, false if it is already there or connection is full
+    // on_subscribed is called once exchange replied to the subscription on a current connection
+    bool subscribe(const std::string& stream, SubscribedHandler on_subscribed = {}) {
+        if (streams.size() >= max_streams || std::find(streams.begin(), streams.end(), stream) != streams.end()) return false;
+        streams.push_back(stream);
+        if (on_subscribed) pending_subscribed[stream] = std::move(on_subscribed);
+        if (active) enqueue(active, "SUBSCRIBE", {stream});
+        if (standby) enqueue(standby, "SUBSCRIBE", {stream});
+        return true;
+    }
+
+    bool unsubscribe(const std::string& stream) {
+        auto it = std::find(streams.begin(), streams.end(), stream);
+        if (it == streams.end()) return false;
+        streams.erase(it);
+        pending_subscribed.erase(stream);
+        if (active) enqueue(active, "UNSUBSCRIBE", {stream});
+        if (standby) enqueue(standby, "UNSUBSCRIBE", {stream});
+        forget_symbol(stream);
+        return true;
+    }
+
+    // streams exchange has on active connection, handler is not called without one
+    void list_subscriptions(ListHandler on_list) {
+        if (active) enqueue(active, "LIST_SUBSCRIPTIONS", {}, std::move(on_list));
+    }
+
+    void close() {
+        closed = true;
+        rotate_timer.cancel();
+        reconnect_timer.cancel();
+        ping_timer.cancel();
+        pending_subscribed.clear();
+        connected = false;
+        for (auto& c : {active, standby}) {
+            if (!c) continue;
+            c->pace_timer.cancel();
+            if (c->ready) c->ws.async_close([c](beast::error_code) { });
+        }
+        active.reset();
+        standby.reset();
+    }
+
+    [[nodiscard]] uint64_t get_reconnects() const { return reconnects.load(std::memory_order_relaxed); }
+    [[nodiscard]] bool is_connected() const { return connected.load(std::memory_order_relaxed); }
+    [[nodiscard]] const PingStats& get_ping_stats() const { return ping_stats; }
+    [[nodiscard]] const std::string& get_host() const { return host; }
+    [[nodiscard]] const std::vector<std::string>& get_streams() const { return streams; }
+};
+
+
+#endif //ARB_FEED_SUPERVISOR_H
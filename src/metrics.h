@@ -0,0 +1,172 @@
+#ifndef ARB_METRICS_H
+#define ARB_METRICS_H
+
+#include <cinttypes>
+#include <atomic>
+#include <array>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include "telemetry.h"
+
+// counter with a cache line per thread, writer only touches its own line and never waits
+// each thread gets a fixed slot, slots are shared only past max_threads threads
+class ShardedCounter {
+public:
+    static constexpr size_t max_threads = 16;
+private:
+    struct alignas(64) Shard {
+    public:
+        std::atomic<uint64_t> value{0};
+    };
+
+    std::array<Shard, max_threads> shards;
+private:
+    static size_t thread_slot() {
+        static std::atomic<size_t> next_slot{0};
+        thread_local size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed) % max_threads;
+        return slot;
+    }
+
+public:
+    void add(uint64_t n = 1) { shards[thread_slot()].value.fetch_add(n, std::memory_order_relaxed); }
+
+    [[nodiscard]] uint64_t get() const {
+        uint64_t sum = 0;
+        for (auto& s : shards) sum += s.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+};
+
+// gauge written by one thread and read by scraper
+class Gauge {
+private:
+    std::atomic<double> value{0};
+public:
+    void set(double v) { value.store(v, std::memory_order_relaxed); }
+    [[nodiscard]] double get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// prometheus text exposition format, version 0.0.4
+class PrometheusWriter {
+private:
+    std::ostringstream out;
+    std::string last_name;
+private:
+    void header(const std::string& name, const char* type, const char* help) {
+        if (name == last_name) return;
+        last_name = name;
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+    }
+
+    void sample(const std::string& name, const std::string& labels, double value) {
+        out << name;
+        if (!labels.empty()) out << '{' << labels << '}';
+        out << ' ' << value << '\n';
+    }
+
+public:
+    PrometheusWriter() { out.precision(12); }
+
+    void counter(const std::string& name, const char* help, double value, const std::string& labels = "") {
+        header(name, "counter", help);
+        sample(name, labels, value);
+    }
+
+    void gauge(const std::string& name, const char* help, double value, const std::string& labels = "") {
+        header(name, "gauge", help);
+        sample(name, labels, value);
+    }
+
+    // nanosecond histogram as summary in seconds, quantiles are of last one or two minutes
+    void summary(const std::string& name, const char* help, const RollingHistogram& h) {
+        header(name, "summary", help);
+        LatencyHistogram window;
+        h.snapshot(window);
+        for (double q : {0.5, 0.9, 0.99, 0.999}) {
+            std::ostringstream label;
+            label << "quantile=\"" << q << '"';
+            sample(name, label.str(), static_cast<double>(window.percentile(q)) / 1e9);
+        }
+        sample(name + "_sum", "", static_cast<double>(h.get_sum()) / 1e9);
+        sample(name + "_count", "", static_cast<double>(h.get_recorded()));
+    }
+
+    [[nodiscard]] std::string str() const { return out.str(); }
+};
+
+// minimal http listener for prometheus scrapes, runs on given io and answers every request
+// with current metrics, connection is closed after each response
+class MetricsServer {
+public:
+    using Renderer = std::function<std::string()>;
+private:
+    struct Session {
+    public:
+        boost::beast::tcp_stream stream;
+        boost::beast::flat_buffer buffer;
+        boost::beast::http::request<boost::beast::http::empty_body> request;
+        boost::beast::http::response<boost::beast::http::string_body> response;
+
+        explicit Session(boost::asio::ip::tcp::socket socket) : stream(std::move(socket)) { }
+    };
+
+    static constexpr std::chrono::seconds session_timeout{5};
+
+    boost::asio::ip::tcp::acceptor acceptor;
+    Renderer render;
+    bool closed{};
+private:
+    void accept() {
+        acceptor.async_accept([this](boost::beast::error_code ec, boost::asio::ip::tcp::socket socket) {
+            if (closed) return;
+            if (!ec) serve(std::make_shared<Session>(std::move(socket)));
+            accept();
+        });
+    }
+
+    void serve(const std::shared_ptr<Session>& s) {
+        s->stream.expires_after(session_timeout);
+        boost::beast::http::async_read(s->stream, s->buffer, s->request, [this, s](boost::beast::error_code ec, size_t) {
+            if (ec) return;
+            namespace http = boost::beast::http;
+            bool found = s->request.target() == "/metrics" || s->request.target() == "/";
+            s->response.version(s->request.version());
+            s->response.result(found ? http::status::ok : http::status::not_found);
+            s->response.set(http::field::content_type, "text/plain; version=0.0.4");
+            s->response.body() = found ? render() : "not found\n";
+            s->response.keep_alive(false);
+            s->response.prepare_payload();
+            http::async_write(s->stream, s->response, [s](boost::beast::error_code, size_t) {
+                boost::beast::error_code ignored;
+                s->stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send, ignored);
+            });
+        });
+    }
+
+public:
+    MetricsServer(boost::asio::io_context& io, const std::string& address, uint16_t port, Renderer render) :
+            acceptor(io, {boost::asio::ip::make_address(address), port}),
+            render(std::move(render))
+    { }
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    void start() { accept(); }
+
+    // open sessions end by themselves within session timeout
+    void close() {
+        closed = true;
+        boost::beast::error_code ec;
+        acceptor.close(ec);
+    }
+};
+
+
+#endif //ARB_METRICS_H
@@ -0,0 +1,405 @@
+#ifndef ARB_MULTICAST_H
+#define ARB_MULTICAST_H
+
+#include <cinttypes>
+#include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstring>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <boost/asio.hpp>
+#include "order_book.h"
+
+// book snapshots over udp multicast, every datagram carries one snapshot, publisher epoch and a sequence number
+// subscriber asks publisher over tcp for datagrams it missed ('R <from> <to>'), or for latest
+// snapshot of every symbol ('S') on start, when missed ones are no longer kept and when epoch changes,
+// because restarted publisher starts its sequence over
+// fields are in host byte order, publisher and subscribers are expected to run on the same architecture
+namespace multicast_wire {
+    static constexpr uint32_t magic = 0x41524232; // 'ARB2'
+    static constexpr size_t header_size = 4 + 8 + 8 + 2;
+    static constexpr size_t fixed_size = BookSnapshot::symbol_size + 8 + 8 + 8 + 2 + 2;
+    static constexpr size_t max_packet = header_size + fixed_size + 2 * BookSnapshot::max_levels * sizeof(BookLevel);
+
+    using Packet = std::array<char, max_packet>;
+
+    template<class T>
+    inline void put(char*& p, const T& v) {
+        std::memcpy(p, &v, sizeof(T));
+        p += sizeof(T);
+    }
+
+    template<class T>
+    inline void get(const char*& p, T& v) {
+        std::memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+    }
+
+    // only used levels are written
+    inline size_t encode(uint64_t epoch, uint64_t seq, const BookSnapshot& s, Packet& out) {
+        char* p = out.data();
+        put(p, magic);
+        put(p, epoch);
+        put(p, seq);
+        char* size_pos = p;
+        p += 2;
+        std::memcpy(p, s.symbol, BookSnapshot::symbol_size);
+        p += BookSnapshot::symbol_size;
+        put(p, s.update_id);
+        put(p, s.exchange_ms);
+        put(p, s.publish_ns);
+        put(p, static_cast<uint16_t>(s.bid_count));
+        put(p, static_cast<uint16_t>(s.ask_count));
+        std::memcpy(p, s.bids, s.bid_count * sizeof(BookLevel));
+        p += s.bid_count * sizeof(BookLevel);
+        std::memcpy(p, s.asks, s.ask_count * sizeof(BookLevel));
+        p += s.ask_count * sizeof(BookLevel);
+        auto size = static_cast<uint16_t>(p - out.data());
+        std::memcpy(size_pos, &size, sizeof(size));
+        return size;
+    }
+
+    inline bool decode(const char* data, size_t size, uint64_t& epoch, uint64_t& seq, BookSnapshot& s) {
+        if (size < header_size + fixed_size) return false;
+        const char* p = data;
+        uint32_t m;
+        uint16_t packet_size, bid_count, ask_count;
+        get(p, m);
+        get(p, epoch);
+        get(p, seq);
+        get(p, packet_size);
+        if (m != magic || packet_size != size) return false;
+        std::memcpy(s.symbol, p, BookSnapshot::symbol_size);
+        s.symbol[BookSnapshot::symbol_size - 1] = 0;
+        p += BookSnapshot::symbol_size;
+        get(p, s.update_id);
+        get(p, s.exchange_ms);
+        get(p, s.publish_ns);
+        get(p, bid_count);
+        get(p, ask_count);
+        if (bid_count > BookSnapshot::max_levels || ask_count > BookSnapshot::max_levels) return false;
+        if (size != header_size + fixed_size + (bid_count + ask_count) * sizeof(BookLevel)) return false;
+        s.bid_count = bid_count;
+        s.ask_count = ask_count;
+        std::memcpy(s.bids, p, bid_count * sizeof(BookLevel));
+        p += bid_count * sizeof(BookLevel);
+        std::memcpy(s.asks, p, ask_count * sizeof(BookLevel));
+        return true;
+    }
+
+    // 'host:port', port is required
+    inline std::pair<std::string, uint16_t> split_host_port(const std::string& s) {
+        size_t pos = s.rfind(':');
+        if (pos == std::string::npos) throw std::runtime_error("Expected host:port, got '" + s + "'");
+        return {s.substr(0, pos), static_cast<uint16_t>(std::stoi(s.substr(pos + 1)))};
+    }
+}
+
+class MulticastPublisher {
+public:
+    static constexpr size_t history = 4096; // datagrams kept for retransmit
+private:
+    struct Sent {
+    public:
+        uint64_t seq{};
+        uint16_t size{};
+        multicast_wire::Packet data{};
+    };
+
+    struct Session {
+    public:
+        boost::asio::ip::tcp::socket socket;
+        boost::asio::streambuf request;
+        std::string response;
+
+        explicit Session(boost::asio::ip::tcp::socket socket) : socket(std::move(socket)) { }
+    };
+
+    boost::asio::ip::udp::socket socket;
+    boost::asio::ip::udp::endpoint group;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::vector<Sent> sent;
+    std::unordered_map<std::string, Sent> latest; // by symbol, for snapshot requests
+    uint64_t epoch;    // start time, tells subscribers that sequence started over
+    uint64_t next_seq = 1;
+    uint64_t send_errors{};
+    bool closed{};
+private:
+    static void append(std::string& out, const Sent& p) {
+        uint32_t size = p.size;
+        out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        out.append(p.data.data(), p.size);
+    }
+
+    void accept() {
+        acceptor.async_accept([this](boost::system::error_code ec, boost::asio::ip::tcp::socket s) {
+            if (closed) return;
+            if (!ec) serve(std::make_shared<Session>(std::move(s)));
+            accept();
+        });
+    }
+
+    void serve(const std::shared_ptr<Session>& s) {
+        boost::asio::async_read_until(s->socket, s->request, '\n', [this, s](boost::system::error_code ec, size_t) {
+            if (ec) return;
+            std::istream in(&s->request);
+            char kind = 0;
+            uint64_t from = 0, to = 0;
+            in >> kind >> from >> to;
+
+            uint64_t oldest = next_seq > history ? next_seq - history : 1;
+            if (kind == 'R' && from >= oldest && from <= to) {
+                for (uint64_t seq = from; seq <= to && seq < next_seq; ++seq) append(s->response, sent[seq % history]);
+            }
+            else { // snapshot, also answer to retransmit of datagrams which are gone
+                for (auto& [symbol, p] : latest) append(s->response, p);
+            }
+            boost::asio::async_write(s->socket, boost::asio::buffer(s->response), [s](boost::system::error_code, size_t) {
+                boost::system::error_code ignored;
+                s->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+            });
+        });
+    }
+
+public:
+    // interface is address of local interface for outgoing datagrams, empty for default route
+    MulticastPublisher(boost::asio::io_context& io, const std::string& group_address, uint16_t port, uint16_t recovery_port, const std::string& interface = "", int ttl = 1) :
+            socket(io),
+            group(boost::asio::ip::make_address(group_address), port),
+            acceptor(io, {boost::asio::ip::tcp::v4(), recovery_port}),
+            sent(history),
+            epoch(static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()))
+    {
+        socket.open(group.protocol());
+        socket.set_option(boost::asio::ip::multicast::hops(ttl));
+        socket.set_option(boost::asio::ip::multicast::enable_loopback(true));
+        if (!interface.empty()) socket.set_option(boost::asio::ip::multicast::outbound_interface(boost::asio::ip::make_address_v4(interface)));
+    }
+
+    MulticastPublisher(const MulticastPublisher&) = delete;
+    MulticastPublisher& operator=(const MulticastPublisher&) = delete;
+
+    void start() { accept(); }
+
+    // datagram is sent right away, udp send doesn't wait for receivers
+    void publish(const BookSnapshot& s) {
+        Sent& p = sent[next_seq % history];
+        p.seq = next_seq++;
+        p.size = static_cast<uint16_t>(multicast_wire::encode(epoch, p.seq, s, p.data));
+        boost::system::error_code ec;
+        socket.send_to(boost::asio::buffer(p.data.data(), p.size), group, 0, ec);
+        if (ec) send_errors++;
+        latest[s.symbol] = p;
+    }
+
+    void close() {
+        closed = true;
+        boost::system::error_code ec;
+        acceptor.close(ec);
+        socket.close(ec);
+    }
+
+    [[nodiscard]] uint64_t get_sequence() const { return next_seq - 1; }
+    [[nodiscard]] uint64_t get_epoch() const { return epoch; }
+    [[nodiscard]] uint64_t get_send_errors() const { return send_errors; }
+};
+
+class MulticastSubscriber {
+public:
+    using Handler = std::function<void(const BookSnapshot&)>;
+    static constexpr std::chrono::seconds recovery_timeout{5}; // connect, request and whole response
+private:
+    struct Recovery {
+    public:
+        boost::asio::ip::tcp::socket socket;
+        std::string request;
+        std::vector<char> response;
+        std::array<char, 65536> chunk{};
+        bool timed_out{};
+
+        Recovery(boost::asio::io_context& io, std::string request) : socket(io), request(std::move(request)) { }
+    };
+
+    boost::asio::io_context& io;
+    boost::asio::ip::udp::socket socket;
+    boost::asio::ip::udp::endpoint sender;
+    boost::asio::ip::tcp::endpoint recovery_endpoint;
+    boost::asio::steady_timer recovery_timer;
+    std::weak_ptr<Recovery> recovery; // running one, so close and timeout can abort it
+    multicast_wire::Packet buffer{};
+    Handler handler;
+    std::unordered_map<std::string, uint64_t> last_update_ids;
+    uint64_t epoch{};        // of publisher we follow
+    uint64_t expected_seq{}; // 0 until first datagram
+    // one recovery request at a time, the next one waits; snapshot covers any missed range
+    uint64_t pending_from{}, pending_to{};
+    bool pending_snapshot{};
+    bool recovering{};
+    bool closed{};
+    std::atomic<uint64_t> received{0};
+    std::atomic<uint64_t> gaps{0};
+    std::atomic<uint64_t> recovered{0};
+private:
+    void receive() {
+        socket.async_receive_from(boost::asio::buffer(buffer), sender, [this](boost::system::error_code ec, size_t size) {
+            if (closed) return;
+            if (!ec) on_datagram(size);
+            receive();
+        });
+    }
+
+    void on_datagram(size_t size) {
+        uint64_t datagram_epoch, seq;
+        BookSnapshot s;
+        if (!multicast_wire::decode(buffer.data(), size, datagram_epoch, seq, s)) return;
+        received.fetch_add(1, std::memory_order_relaxed);
+
+        if (expected_seq == 0 || datagram_epoch != epoch) { // start or publisher restart, old ranges mean nothing now
+            epoch = datagram_epoch;
+            expected_seq = seq + 1;
+            request_snapshot();
+        }
+        else if (seq > expected_seq) {
+            gaps.fetch_add(seq - expected_seq, std::memory_order_relaxed);
+            request_range(expected_seq, seq - 1);
+        }
+        if (seq >= expected_seq) expected_seq = seq + 1;
+        deliver(s);
+    }
+
+    // snapshots are whole books, older one must not replace newer
+    void deliver(const BookSnapshot& s) {
+        uint64_t& last = last_update_ids[s.symbol];
+        if (s.update_id <= last) return;
+        last = s.update_id;
+        handler(s);
+    }
+
+    void request_snapshot() {
+        pending_from = pending_to = 0;
+        if (!recovering) return request("S\n");
+        pending_snapshot = true;
+    }
+
+    void request_range(uint64_t from, uint64_t to) {
+        if (!recovering) return request("R " + std::to_string(from) + " " + std::to_string(to) + "\n");
+        if (pending_snapshot) return;
+        pending_from = pending_from == 0 ? from : std::min(pending_from, from);
+        pending_to = std::max(pending_to, to);
+    }
+
+    // only through request_snapshot and request_range, which keep one request running
+    // deadline closes the socket, so the pending operation ends with an error and finishes recovery
+    void request(std::string line) {
+        recovering = true;
+        auto r = std::make_shared<Recovery>(io, std::move(line));
+        recovery = r;
+        recovery_timer.expires_after(recovery_timeout);
+        recovery_timer.async_wait([weak = recovery](boost::system::error_code ec) {
+            auto r = weak.lock();
+            if (ec || !r) return;
+            r->timed_out = true;
+            boost::system::error_code ignored;
+            r->socket.close(ignored);
+        });
+        r->socket.async_connect(recovery_endpoint, [this, r](boost::system::error_code ec) {
+            if (ec) return fail_recovery(*r, ec);
+            boost::asio::async_write(r->socket, boost::asio::buffer(r->request), [this, r](boost::system::error_code ec, size_t) {
+                if (ec) return fail_recovery(*r, ec);
+                read_recovery(r);
+            });
+        });
+    }
+
+    void fail_recovery(const Recovery& r, boost::system::error_code ec) {
+        finish_recovery(r.timed_out ? boost::asio::error::timed_out : ec);
+    }
+
+    void read_recovery(const std::shared_ptr<Recovery>& r) {
+        r->socket.async_read_some(boost::asio::buffer(r->chunk), [this, r](boost::system::error_code ec, size_t n) {
+            r->response.insert(r->response.end(), r->chunk.begin(), r->chunk.begin() + static_cast<std::ptrdiff_t>(n));
+            if (!ec) return read_recovery(r);
+            if (ec != boost::asio::error::eof) return fail_recovery(*r, ec);
+
+            // response is length prefixed datagrams
+            size_t pos = 0;
+            while (pos + 4 <= r->response.size()) {
+                uint32_t size;
+                std::memcpy(&size, r->response.data() + pos, sizeof(size));
+                pos += 4;
+                if (pos + size > r->response.size()) break;
+                uint64_t datagram_epoch, seq;
+                BookSnapshot s;
+                if (multicast_wire::decode(r->response.data() + pos, size, datagram_epoch, seq, s) && datagram_epoch == epoch) {
+                    recovered.fetch_add(1, std::memory_order_relaxed);
+                    deliver(s);
+                }
+                pos += size;
+            }
+            finish_recovery({});
+        });
+    }
+
+    void finish_recovery(boost::system::error_code ec) {
+        recovering = false;
+        recovery.reset();
+        recovery_timer.cancel();
+        if (closed) return;
+        if (ec) std::cout << "market data recovery: " << ec.message() << std::endl;
+        if (pending_snapshot) {
+            pending_snapshot = false;
+            return request_snapshot();
+        }
+        if (pending_from == 0) return;
+        uint64_t from = pending_from, to = pending_to;
+        pending_from = pending_to = 0;
+        request_range(from, to);
+    }
+
+public:
+    // interface is address of local interface to join group on, empty for any
+    MulticastSubscriber(boost::asio::io_context& io, const std::string& group_address, uint16_t port, const std::string& recovery_host, uint16_t recovery_port, Handler handler, const std::string& interface = "") :
+            io(io),
+            socket(io),
+            recovery_timer(io),
+            handler(std::move(handler))
+    {
+        auto group = boost::asio::ip::make_address(group_address);
+        boost::asio::ip::udp::endpoint listen(group.is_v6() ? boost::asio::ip::address(boost::asio::ip::address_v6::any()) : boost::asio::ip::address(boost::asio::ip::address_v4::any()), port);
+        socket.open(listen.protocol());
+        socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+        socket.bind(listen);
+        if (interface.empty() || group.is_v6()) socket.set_option(boost::asio::ip::multicast::join_group(group));
+        else socket.set_option(boost::asio::ip::multicast::join_group(group.to_v4(), boost::asio::ip::make_address_v4(interface)));
+
+        boost::asio::ip::tcp::resolver resolver(io);
+        recovery_endpoint = *resolver.resolve(recovery_host, std::to_string(recovery_port)).begin();
+    }
+
+    MulticastSubscriber(const MulticastSubscriber&) = delete;
+    MulticastSubscriber& operator=(const MulticastSubscriber&) = delete;
+
+    void start() { receive(); }
+
+    // on io thread, running recovery is aborted so io can run out of work
+    void close() {
+        closed = true;
+        boost::system::error_code ec;
+        socket.close(ec);
+        recovery_timer.cancel();
+        if (auto r = recovery.lock()) r->socket.close(ec);
+    }
+
+    [[nodiscard]] uint64_t get_received() const { return received.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t get_gaps() const { return gaps.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t get_recovered() const { return recovered.load(std::memory_order_relaxed); }
+};
+
+
+#endif //ARB_MULTICAST_H
@@ -0,0 +1,79 @@
+#ifndef ARB_OPTIONS_H
+#define ARB_OPTIONS_H
+
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_map>
+#include <initializer_list>
+
+enum class OptionKind {
+    flag,           // --name
+    value,          // --name=value
+    optional_value, // either
+};
+
+struct OptionSpec {
+public:
+    const char* name;
+    OptionKind kind;
+};
+
+// optional '--name=value' arguments after the positional ones
+// names are checked against the list a command accepts, so a mistyped limit is an error, not a silent default
+class Options {
+private:
+    std::unordered_map<std::string, std::string> values;
+private:
+    [[noreturn]] static void fail_number(const std::string& name, const std::string& value) {
+        throw std::runtime_error("Option '--" + name + "' expects a number, got '" + value + "'");
+    }
+public:
+    Options(int argc, char** argv, std::initializer_list<OptionSpec> known) {
+        for (int i = 0; i < argc; ++i) {
+            std::string arg = argv[i];
+            size_t eq = arg.find('=');
+            if (arg.rfind("--", 0) != 0) throw std::runtime_error("Invalid option '" + arg + "', expected --name=value");
+            std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+            auto spec = std::find_if(known.begin(), known.end(), [&](const OptionSpec& s) { return name == s.name; });
+            if (spec == known.end()) throw std::runtime_error("Unknown option '--" + name + "'");
+            if (eq == std::string::npos && spec->kind == OptionKind::value) throw std::runtime_error("Option '--" + name + "' needs a value, use --" + name + "=<value>");
+            if (eq != std::string::npos && spec->kind == OptionKind::flag) throw std::runtime_error("Option '--" + name + "' takes no value");
+            if (eq == std::string::npos) values[name] = "1"; // flag without value
+            else values[name] = arg.substr(eq + 1);
+        }
+    }
+
+    [[maybe_unused]] bool has(const std::string& name) const { return values.count(name) > 0; }
+
+    [[maybe_unused]] std::string get_string(const std::string& name, std::string def = "") const {
+        auto it = values.find(name);
+        return it == values.end() ? std::move(def) : it->second;
+    }
+
+    // whole value must be a number
+    [[maybe_unused]] int get_int(const std::string& name, int def = 0) const {
+        auto it = values.find(name);
+        if (it == values.end()) return def;
+        size_t pos = 0;
+        int v;
+        try { v = std::stoi(it->second, &pos); }
+        catch (std::exception&) { fail_number(name, it->second); }
+        if (pos != it->second.size()) fail_number(name, it->second);
+        return v;
+    }
+
+    [[maybe_unused]] double get_double(const std::string& name, double def = 0) const {
+        auto it = values.find(name);
+        if (it == values.end()) return def;
+        size_t pos = 0;
+        double v;
+        try { v = std::stod(it->second, &pos); }
+        catch (std::exception&) { fail_number(name, it->second); }
+        if (pos != it->second.size()) fail_number(name, it->second);
+        return v;
+    }
+};
+
+
+#endif //ARB_OPTIONS_H
@@ -0,0 +1,187 @@
+#ifndef ARB_ORDER_BOOK_H
+#define ARB_ORDER_BOOK_H
+
+#include <cinttypes>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <cstring>
+
+struct BookLevel {
+public:
+    double price;
+    double quantity;
+};
+
+// normalized top of the book, plain data so it can be copied into shared memory or a datagram as is
+struct BookSnapshot {
+public:
+    static constexpr size_t max_levels = 20;
+    static constexpr size_t symbol_size = 16;
+
+    char symbol[symbol_size];
+    uint64_t update_id;
+    int64_t exchange_ms; // event time of last applied update
+    int64_t publish_ns;  // unix time when feed handler published it
+    uint32_t bid_count;
+    uint32_t ask_count;
+    BookLevel bids[max_levels];
+    BookLevel asks[max_levels];
+
+    void set_symbol(const std::string& s) {
+        std::memset(symbol, 0, symbol_size);
+        std::memcpy(symbol, s.data(), std::min(s.size(), symbol_size - 1));
+    }
+
+    [[nodiscard]] bool is_symbol(const std::string& s) const { return std::strncmp(symbol, s.c_str(), symbol_size) == 0; }
+};
+
+// diff of venue book, normalized from venue message by exchange adapter
+// full book snapshot has the same shape, final_id is its last update id
+struct DepthUpdate {
+public:
+    uint64_t first_id{};
+    uint64_t final_id{};
+    int64_t event_ms{};
+    std::vector<BookLevel> bids;
+    std::vector<BookLevel> asks;
+};
+
+enum class BookUpdateResult {
+    applied,
+    stale, // already included in the book
+    gap,   // book missed some updates and must be reloaded from snapshot
+};
+
+// local copy of exchange order book, kept from a REST snapshot and diff depth events
+// levels are sorted best first, so top of the book is at the front of both sides
+// watermark is the deepest price of each side that reader cares about, book is dirty only
+// when a change touches a level at or above it
+class OrderBook {
+private:
+    std::vector<BookLevel> bids;
+    std::vector<BookLevel> asks;
+    uint64_t last_update_id{};
+    bool synced{};
+    double bid_watermark = -std::numeric_limits<double>::infinity(); // every level matters by default
+    double ask_watermark = std::numeric_limits<double>::infinity();
+    bool dirty = true;
+private:
+    template<class Better>
+    static void set_level(std::vector<BookLevel>& side, double price, double quantity, Better better) {
+        auto it = std::lower_bound(side.begin(), side.end(), price, [&](const BookLevel& l, double p) { return better(l.price, p); });
+        bool exists = it != side.end() && it->price == price;
+        if (quantity == 0) {
+            if (exists) side.erase(it);
+            return;
+        }
+        if (exists) it->quantity = quantity;
+        else side.insert(it, BookLevel{price, quantity});
+    }
+
+    // copies levels of top snapshot, returns true if any level at or above watermark changed
+    template<class Better>
+    static bool copy_levels(std::vector<BookLevel>& side, const BookLevel* levels, size_t count, Better better, double watermark) {
+        bool touched = false;
+        for (size_t i = 0; i < std::max(side.size(), count) && !touched; ++i) {
+            const BookLevel* a = i < side.size() ? &side[i] : nullptr;
+            const BookLevel* b = i < count ? &levels[i] : nullptr;
+            bool relevant = (a && !better(watermark, a->price)) || (b && !better(watermark, b->price));
+            if (!relevant) break; // both sides are already past watermark, deeper levels are sorted further away
+            touched = !a || !b || a->price != b->price || a->quantity != b->quantity;
+        }
+        side.assign(levels, levels + count);
+        return touched;
+    }
+
+    // returns true if any level at or above watermark changed
+    template<class Better>
+    static bool set_levels(std::vector<BookLevel>& side, const std::vector<BookLevel>& levels, Better better, double watermark) {
+        bool touched = false;
+        for (auto& l : levels) {
+            set_level(side, l.price, l.quantity, better);
+            touched |= !better(watermark, l.price);
+        }
+        return touched;
+    }
+
+public:
+    explicit OrderBook(size_t reserve_levels = 5000) {
+        bids.reserve(reserve_levels);
+        asks.reserve(reserve_levels);
+    }
+
+    // full book from venue
+    void load_snapshot(const DepthUpdate& snapshot) {
+        bids.clear();
+        asks.clear();
+        set_levels(bids, snapshot.bids, std::greater<>(), bid_watermark);
+        set_levels(asks, snapshot.asks, std::less<>(), ask_watermark);
+        last_update_id = snapshot.final_id;
+        synced = true;
+        dirty = true;
+    }
+
+    // top of the book from feed handler, replaces whole book
+    void load_snapshot(const BookSnapshot& s) {
+        dirty |= copy_levels(bids, s.bids, s.bid_count, std::greater<>(), bid_watermark);
+        dirty |= copy_levels(asks, s.asks, s.ask_count, std::less<>(), ask_watermark);
+        last_update_id = s.update_id;
+        synced = true;
+    }
+
+    // fills top levels of snapshot, symbol and times are left to caller
+    void make_snapshot(BookSnapshot& s) const {
+        s.bid_count = static_cast<uint32_t>(std::min(bids.size(), BookSnapshot::max_levels));
+        s.ask_count = static_cast<uint32_t>(std::min(asks.size(), BookSnapshot::max_levels));
+        std::copy(bids.begin(), bids.begin() + s.bid_count, s.bids);
+        std::copy(asks.begin(), asks.begin() + s.ask_count, s.asks);
+        s.update_id = last_update_id;
+    }
+
+    // diff depth event, first event after snapshot may overlap it
+    BookUpdateResult apply(const DepthUpdate& update) {
+        if (!synced) return BookUpdateResult::gap;
+        if (update.final_id <= last_update_id) return BookUpdateResult::stale;
+        if (update.first_id > last_update_id + 1) {
+            synced = false;
+            return BookUpdateResult::gap;
+        }
+
+        dirty |= set_levels(bids, update.bids, std::greater<>(), bid_watermark);
+        dirty |= set_levels(asks, update.asks, std::less<>(), ask_watermark);
+        last_update_id = update.final_id;
+        return BookUpdateResult::applied;
+    }
+
+    void reset() {
+        bids.clear();
+        asks.clear();
+        last_update_id = 0;
+        synced = false;
+        dirty = true;
+    }
+
+    // index of deepest level reader used on each side, index past the end means any depth matters
+    void set_watermark(size_t bid_index, size_t ask_index) {
+        bid_watermark = bid_index < bids.size() ? bids[bid_index].price : -std::numeric_limits<double>::infinity();
+        ask_watermark = ask_index < asks.size() ? asks[ask_index].price : std::numeric_limits<double>::infinity();
+    }
+
+    // true once after every change at or above watermark
+    bool take_dirty() {
+        bool was = dirty;
+        dirty = false;
+        return was;
+    }
+
+    [[nodiscard]] bool is_synced() const { return synced; }
+    [[nodiscard]] uint64_t get_last_update_id() const { return last_update_id; }
+    [[nodiscard]] const std::vector<BookLevel>& get_bids() const { return bids; }
+    [[nodiscard]] const std::vector<BookLevel>& get_asks() const { return asks; }
+};
+
+
+#endif //ARB_ORDER_BOOK_H
@@ -0,0 +1,222 @@
+#ifndef ARB_PERF_COUNTERS_H
+#define ARB_PERF_COUNTERS_H
+
+#include <cinttypes>
+#include <atomic>
+#include <array>
+#include <ostream>
+#include <iomanip>
+#include "telemetry.h"
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// hardware counters of calling thread: cycles, instructions, cache misses and branch misses
+// counters are opened once per thread and read with rdpmc from user space when kernel allows it,
+// otherwise with one read() of the whole group
+// only user space is counted, so it works with default perf_event_paranoid
+class PerfCounters {
+public:
+    static constexpr size_t counter_count = 4;
+    using Sample = std::array<uint64_t, counter_count>;
+private:
+    static inline std::atomic<bool> enabled{false};
+
+    std::array<int, counter_count> fds{-1, -1, -1, -1};
+    std::array<size_t, counter_count> group_index{}; // position of counter in group read
+    size_t group_size{};
+#ifdef __linux__
+    std::array<perf_event_mmap_page*, counter_count> pages{};
+#endif
+private:
+#ifdef __linux__
+    static int open_event(uint64_t config, int group_fd) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    static uint64_t rdpmc(uint32_t counter) {
+        uint32_t low, high;
+        asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+        return low | static_cast<uint64_t>(high) << 32;
+    }
+
+    // seqlock read of counter page, false if counter is not on pmu right now
+    static bool read_user(const perf_event_mmap_page* pc, uint64_t& value) {
+        uint32_t seq;
+        do {
+            seq = pc->lock;
+            std::atomic_signal_fence(std::memory_order_acquire);
+            uint32_t index = pc->index;
+            if (!pc->cap_user_rdpmc || index == 0) return false;
+            int64_t count = pc->offset;
+            int64_t pmc = static_cast<int64_t>(rdpmc(index - 1) << (64 - pc->pmc_width)) >> (64 - pc->pmc_width);
+            value = static_cast<uint64_t>(count + pmc);
+            std::atomic_signal_fence(std::memory_order_acquire);
+        } while (pc->lock != seq);
+        return true;
+    }
+#else
+    static bool read_user(const perf_event_mmap_page*, uint64_t&) { return false; }
+#endif
+#endif
+
+    PerfCounters() {
+#ifdef __linux__
+        static constexpr uint64_t configs[counter_count] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        long page_size = sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < counter_count; ++i) {
+            fds[i] = open_event(configs[i], fds[0]);
+            if (fds[i] < 0) {
+                if (i == 0) return; // no cycles counter, nothing else can be grouped
+                continue;
+            }
+            group_index[i] = group_size++;
+            void* page = mmap(nullptr, static_cast<size_t>(page_size), PROT_READ, MAP_SHARED, fds[i], 0);
+            pages[i] = page == MAP_FAILED ? nullptr : static_cast<perf_event_mmap_page*>(page);
+        }
+#endif
+    }
+
+    void read_group(Sample& out) const {
+#ifdef __linux__
+        uint64_t values[1 + counter_count]{};
+        if (::read(fds[0], values, sizeof(values)) <= 0) return;
+        for (size_t i = 0; i < counter_count; ++i)
+            if (fds[i] >= 0) out[i] = values[1 + group_index[i]];
+#else
+        (void)out;
+#endif
+    }
+
+public:
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+#ifdef __linux__
+        long page_size = sysconf(_SC_PAGESIZE);
+        for (size_t i = counter_count; i-- > 0;) {
+            if (pages[i]) munmap(pages[i], static_cast<size_t>(page_size));
+            if (fds[i] >= 0) close(fds[i]);
+        }
+#endif
+    }
+
+    // must be called before threads which measure regions are started, stays off if counters can't be opened
+    static bool enable() {
+        enabled = local().is_open();
+        return enabled;
+    }
+
+    static bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+
+    static PerfCounters& local() {
+        thread_local PerfCounters counters;
+        return counters;
+    }
+
+    [[nodiscard]] bool is_open() const { return fds[0] >= 0; }
+
+    void read(Sample& out) const {
+        out = {};
+        if (!is_open()) return;
+#ifdef __linux__
+        for (size_t i = 0; i < counter_count; ++i) {
+            if (fds[i] < 0) continue;
+            if (!pages[i] || !read_user(pages[i], out[i])) return read_group(out);
+        }
+#endif
+    }
+};
+
+// counters of one named piece of work, recorded from one thread and printed from any
+class PerfRegion {
+private:
+    const char* name;
+    std::atomic<uint64_t> count{0};
+    std::array<std::atomic<uint64_t>, PerfCounters::counter_count> sums{};
+    LatencyHistogram cycles;
+public:
+    explicit PerfRegion(const char* name) : name(name) { }
+
+    PerfRegion(const PerfRegion&) = delete;
+    PerfRegion& operator=(const PerfRegion&) = delete;
+
+    static bool begin(PerfCounters::Sample& start) {
+        if (!PerfCounters::is_enabled()) return false;
+        PerfCounters::local().read(start);
+        return true;
+    }
+
+    void end(const PerfCounters::Sample& start) {
+        PerfCounters::Sample now;
+        PerfCounters::local().read(now);
+        for (size_t i = 0; i < sums.size(); ++i) sums[i].fetch_add(now[i] - start[i], std::memory_order_relaxed);
+        cycles.record(now[0] - start[0]);
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const PerfRegion& r) {
+        uint64_t n = r.count.load(std::memory_order_relaxed);
+        auto avg = [&](size_t i) { return n > 0 ? static_cast<double>(r.sums[i].load(std::memory_order_relaxed)) / static_cast<double>(n) : 0.0; };
+        os << std::left << std::setw(12) << r.name << std::right << std::fixed << std::setprecision(1)
+           << " count: " << std::setw(8) << n
+           << " cycles avg: " << std::setw(9) << avg(0)
+           << " p50: " << std::setw(9) << r.cycles.percentile(0.5)
+           << " p99: " << std::setw(9) << r.cycles.percentile(0.99)
+           << " instructions: " << std::setw(9) << avg(1)
+           << " ipc: " << std::setprecision(2) << (avg(0) > 0 ? avg(1) / avg(0) : 0.0) << std::setprecision(1)
+           << " cache misses: " << avg(2)
+           << " branch misses: " << avg(3);
+        os.unsetf(std::ios_base::floatfield);
+        return os;
+    }
+};
+
+// measures the enclosing scope, costs one branch when counters are disabled
+class PerfScope {
+private:
+    PerfRegion& region;
+    PerfCounters::Sample start;
+    bool active;
+public:
+    explicit PerfScope(PerfRegion& region) : region(region), start(), active(PerfRegion::begin(start)) { }
+    ~PerfScope() { if (active) region.end(start); }
+
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+};
+
+// regions of the hot path, from socket to order
+struct PerfRegions {
+public:
+    PerfRegion ws_read{"ws_read"};         // feed thread work while waiting for a frame: tls decrypt, websocket framing, asio
+    PerfRegion json_parse{"json_parse"};
+    PerfRegion strategy{"strategy"};       // book update and decision in update()
+    PerfRegion order_build{"order_build"}; // query and signature of an order
+
+    friend std::ostream& operator<<(std::ostream& os, const PerfRegions& r) {
+        return os << "Perf counters (per call) {"
+                  << "\n\t" << r.ws_read
+                  << "\n\t" << r.json_parse
+                  << "\n\t" << r.strategy
+                  << "\n\t" << r.order_build
+                  << "\n}";
+    }
+};
+
+inline PerfRegions perf_regions;
+
+
+#endif //ARB_PERF_COUNTERS_H
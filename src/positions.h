@@ -0,0 +1,270 @@
+#ifndef ARB_POSITIONS_H
+#define ARB_POSITIONS_H
+
+#include <cinttypes>
+#include <array>
+#include <cstddef>
+#include <ostream>
+#include "timer_wheel.h"
+
+// fixed-capacity pool, free objects are linked through their own 'pool_next' member
+template<class T, size_t Capacity>
+class ObjectPool {
+private:
+    std::array<T, Capacity> items;
+    T* free_head;
+    size_t used{};
+public:
+    ObjectPool() : free_head(nullptr) {
+        for (size_t i = Capacity; i-- > 0;) {
+            items[i].pool_next = free_head;
+            free_head = &items[i];
+        }
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // nullptr when pool is exhausted
+    T* acquire() {
+        T* item = free_head;
+        if (!item) return nullptr;
+        free_head = item->pool_next;
+        item->pool_next = nullptr;
+        used++;
+        return item;
+    }
+
+    void release(T* item) {
+        item->pool_next = free_head;
+        free_head = item;
+        used--;
+    }
+
+    [[nodiscard]] size_t index_of(const T* item) const { return static_cast<size_t>(item - items.data()); }
+    [[nodiscard]] T& operator[](size_t i) { return items[i]; }
+    [[nodiscard]] size_t size() const { return used; }
+    [[nodiscard]] static constexpr size_t capacity() { return Capacity; }
+};
+
+enum class OrderState {
+    new_order,        // sent, no response yet
+    acked,            // exchange accepted it
+    partially_filled,
+    filled,
+    rejected,         // refused by exchange or never sent
+    canceled,         // canceled or expired with or without partial fill
+};
+
+inline std::ostream& operator<<(std::ostream& os, OrderState s) {
+    static constexpr const char* names[] = {"NEW", "ACKED", "PARTIALLY_FILLED", "FILLED", "REJECTED", "CANCELED"};
+    return os << names[static_cast<int>(s)];
+}
+
+struct Position;
+
+struct Order {
+public:
+    Order* pool_next = nullptr;
+    Order* prev = nullptr; // live orders list
+    Order* next = nullptr;
+    Position* position = nullptr;
+    int64_t order_id = -1;
+    bool is_buy{};
+    double quantity{};
+    double executed{};
+    double cum_quote{};
+    OrderState state = OrderState::new_order;
+
+    [[nodiscard]] bool is_done() const { return state == OrderState::filled || state == OrderState::rejected || state == OrderState::canceled; }
+};
+
+enum class PositionState {
+    opening, // entry order in flight
+    open,
+    closing, // exit order in flight
+};
+
+struct Position {
+public:
+    Position* pool_next = nullptr;
+    Position* prev = nullptr; // active positions list
+    Position* next = nullptr;
+    PositionState state = PositionState::opening;
+    double amount{};  // crypto held
+    double cost{};    // currency spent on entry
+    double revenue{}; // currency received on exit
+    Order* order = nullptr; // order in flight, if any
+    Timer exit_timer;
+    uint8_t exit_triggers{}; // bits of thresholds already crossed while held, so each counts once per position
+};
+
+// positions and orders of a single symbol, everything lives in preallocated pools
+// so opening, tracking and closing positions never allocates
+template<size_t MaxPositions, size_t MaxOrders>
+class PositionManager {
+private:
+    ObjectPool<Position, MaxPositions> positions;
+    ObjectPool<Order, MaxOrders> orders;
+    Position position_list; // sentinels
+    Order order_list;
+    double realized_pnl{}; // revenue minus cost of released positions, in quote currency, exported as arb_realized_pnl
+private:
+    template<class T>
+    static void link(T& head, T& item) {
+        item.next = head.next;
+        item.prev = &head;
+        head.next->prev = &item;
+        head.next = &item;
+    }
+
+    template<class T>
+    static void unlink(T& item) {
+        item.prev->next = item.next;
+        item.next->prev = item.prev;
+        item.prev = item.next = nullptr;
+    }
+
+public:
+    PositionManager() {
+        position_list.prev = position_list.next = &position_list;
+        order_list.prev = order_list.next = &order_list;
+    }
+
+    PositionManager(const PositionManager&) = delete;
+    PositionManager& operator=(const PositionManager&) = delete;
+
+    // exit timer callback of every pooled position is set once here
+    template<class F>
+    void set_exit_callback(F&& f) {
+        for (size_t i = 0; i < MaxPositions; ++i) {
+            Position* p = &positions[i];
+            p->exit_timer.callback = [f, p]() { f(*p); };
+        }
+    }
+
+    // nullptr when there is no room for another position or its order
+    Position* open(bool is_buy, double quantity) {
+        if (orders.size() >= MaxOrders) return nullptr;
+        Position* p = positions.acquire();
+        if (!p) return nullptr;
+        p->state = PositionState::opening;
+        p->amount = p->cost = p->revenue = 0;
+        p->exit_triggers = 0;
+        link(position_list, *p);
+        p->order = new_order(*p, is_buy, quantity);
+        return p;
+    }
+
+    Order* close(Position& p, bool is_buy) {
+        Order* o = new_order(p, is_buy, p.amount);
+        if (!o) return nullptr;
+        p.state = PositionState::closing;
+        p.order = o;
+        return o;
+    }
+
+    Order* new_order(Position& p, bool is_buy, double quantity) {
+        Order* o = orders.acquire();
+        if (!o) return nullptr;
+        o->position = &p;
+        o->order_id = -1;
+        o->is_buy = is_buy;
+        o->quantity = quantity;
+        o->executed = o->cum_quote = 0;
+        o->state = OrderState::new_order;
+        link(order_list, *o);
+        return o;
+    }
+
+    void on_ack(Order& o, int64_t order_id) {
+        o.order_id = order_id;
+        if (o.state == OrderState::new_order) o.state = OrderState::acked;
+    }
+
+    // updates order and its position, position is released once it is flat
+    // dust is the lot step, exit leaving less than that is flat because the rest can't be sold
+    // returns true if position was released
+    bool on_update(Order& o, OrderState state, double executed, double cum_quote, double dust = 0) {
+        Position& p = *o.position;
+        double delta = executed - o.executed;
+        double delta_quote = cum_quote - o.cum_quote;
+        o.state = state;
+        o.executed = executed;
+        o.cum_quote = cum_quote;
+
+        bool entry = p.state == PositionState::opening;
+        if (entry) {
+            p.amount += delta;
+            p.cost += delta_quote;
+        } else {
+            p.amount -= delta;
+            p.revenue += delta_quote;
+        }
+        if (!o.is_done()) return false;
+
+        release_order(o);
+        p.order = nullptr;
+
+        // failed or partly filled exit keeps position open, so the rest is sold on retry
+        bool flat = entry ? p.amount <= 0 : p.amount <= 0 || p.amount < dust;
+        if (!flat) {
+            p.state = PositionState::open;
+            return false;
+        }
+        realized_pnl += p.revenue - p.cost;
+        release_position(p);
+        return true;
+    }
+
+    void release_order(Order& o) {
+        unlink(o);
+        orders.release(&o);
+    }
+
+    void release_position(Position& p) {
+        if (p.order) release_order(*p.order);
+        p.order = nullptr;
+        unlink(p);
+        positions.release(&p);
+    }
+
+    // linear over live orders, there are only a few of them in flight
+    Order* find_order(int64_t order_id) {
+        for (Order* o = order_list.next; o != &order_list; o = o->next)
+            if (o->order_id == order_id) return o;
+        return nullptr;
+    }
+
+    template<class F>
+    void for_each_order(F&& f) {
+        for (Order* o = order_list.next; o != &order_list;) {
+            Order* next = o->next; // f may release order
+            f(*o);
+            o = next;
+        }
+    }
+
+    template<class F>
+    void for_each_position(F&& f) {
+        for (Position* p = position_list.next; p != &position_list;) {
+            Position* next = p->next; // f may release position
+            f(*p);
+            p = next;
+        }
+    }
+
+    [[nodiscard]] double total_amount() const {
+        double sum = 0;
+        for (const Position* p = position_list.next; p != &position_list; p = p->next) sum += p->amount;
+        return sum;
+    }
+
+    [[nodiscard]] double get_realized_pnl() const { return realized_pnl; }
+    [[nodiscard]] size_t position_count() const { return positions.size(); }
+    [[nodiscard]] size_t order_count() const { return orders.size(); }
+    [[nodiscard]] static constexpr size_t max_positions() { return MaxPositions; }
+};
+
+
+#endif //ARB_POSITIONS_H
@@ -0,0 +1,243 @@
+#ifndef ARB_RATE_LIMIT_H
+#define ARB_RATE_LIMIT_H
+
+#include <cinttypes>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <string>
+#include <algorithm>
+#include <boost/beast/http.hpp>
+#include <boost/beast/core/string.hpp>
+#include "../include/rapidjson/document.h"
+
+enum class RequestPriority {
+    order, // may use whole limit
+    info,  // leaves reserved part of limit for orders
+};
+
+enum class RateLimitType {
+    request_weight,
+    orders,
+    raw_requests,
+};
+
+// lock-free token bucket (GCRA): whole state is a single theoretical arrival time
+// every token moves it forward by 'emission', bucket is full when it is 'tolerance' ahead of now
+class TokenBucket {
+private:
+    std::atomic<int64_t> tat{0};
+    std::atomic<int64_t> emission{0};
+    std::atomic<int64_t> tolerance{0};
+public:
+    void set_limit(int64_t limit, int64_t interval_ns) {
+        emission.store(limit > 0 ? interval_ns / limit : 0, std::memory_order_relaxed);
+        tolerance.store(interval_ns, std::memory_order_relaxed);
+    }
+
+    // share is part of the limit this request is allowed to fill, in 0..1
+    bool try_acquire(int64_t tokens, int64_t now, double share = 1.0) {
+        int64_t e = emission.load(std::memory_order_relaxed);
+        if (e == 0) return true;
+        auto limit = static_cast<int64_t>(static_cast<double>(tolerance.load(std::memory_order_relaxed)) * share);
+        int64_t current = tat.load(std::memory_order_relaxed);
+        while (true) {
+            int64_t next = std::max(current, now) + tokens * e;
+            if (next - now > limit) return false;
+            if (tat.compare_exchange_weak(current, next, std::memory_order_acq_rel, std::memory_order_relaxed)) return true;
+        }
+    }
+
+    void release(int64_t tokens) { tat.fetch_sub(tokens * emission.load(std::memory_order_relaxed), std::memory_order_acq_rel); }
+
+    // exchange reports how much was used in current window, never lower our own estimate
+    void set_used(int64_t used, int64_t now) {
+        int64_t next = now + used * emission.load(std::memory_order_relaxed);
+        int64_t current = tat.load(std::memory_order_relaxed);
+        while (current < next && !tat.compare_exchange_weak(current, next, std::memory_order_acq_rel, std::memory_order_relaxed)) { }
+    }
+
+    // time until try_acquire with same arguments may succeed
+    [[nodiscard]] int64_t wait_ns(int64_t tokens, int64_t now, double share = 1.0) const {
+        int64_t e = emission.load(std::memory_order_relaxed);
+        auto limit = static_cast<int64_t>(static_cast<double>(tolerance.load(std::memory_order_relaxed)) * share);
+        int64_t next = std::max(tat.load(std::memory_order_relaxed), now) + tokens * e;
+        return std::max<int64_t>(0, next - now - limit);
+    }
+
+    // used part of the limit, in 0..1
+    [[nodiscard]] double usage(int64_t now) const {
+        int64_t t = tolerance.load(std::memory_order_relaxed);
+        if (t == 0) return 0;
+        return static_cast<double>(std::max<int64_t>(0, tat.load(std::memory_order_relaxed) - now)) / static_cast<double>(t);
+    }
+};
+
+struct RateLimit {
+public:
+    RateLimitType type;
+    std::string header_suffix; // interval as exchange writes it in headers, for example '1M' or '10S'
+    std::atomic<int64_t> limit{0};
+    TokenBucket bucket;
+};
+
+// exchange request limits, seeded from exchangeInfo and corrected by X-MBX-* response headers
+// whole limiter is safe to use from any thread: a limit is never removed or moved once added, seed()
+// changes existing ones in place through atomics and publishes new ones by bumping limit_count
+class RateLimiter {
+public:
+    static constexpr size_t max_limits = 8;
+private:
+    std::array<RateLimit, max_limits> limits;
+    std::atomic<size_t> limit_count{0};
+    std::mutex seed_mutex; // writers only, requests never take it
+    double info_share;
+    std::atomic<int64_t> banned_until{0};
+private:
+    static int64_t now_ns() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+    static int64_t interval_to_ns(const std::string& interval, int64_t num) {
+        int64_t seconds = 1;
+        if (interval == "MINUTE") seconds = 60;
+        else if (interval == "HOUR") seconds = 60 * 60;
+        else if (interval == "DAY") seconds = 24 * 60 * 60;
+        return seconds * num * 1000 * 1000 * 1000;
+    }
+
+    static std::string interval_to_suffix(const std::string& interval, int64_t num) {
+        return std::to_string(num) + interval[0];
+    }
+
+    // caller holds seed_mutex
+    void add_limit(RateLimitType type, const std::string& interval, int64_t num, int64_t limit) {
+        std::string suffix = interval_to_suffix(interval, num);
+        size_t count = limit_count.load(std::memory_order_relaxed);
+        RateLimit* l = find_limit(type, suffix);
+        bool added = !l;
+        if (added) {
+            if (count >= max_limits) return;
+            l = &limits[count];
+            l->type = type;
+            l->header_suffix = suffix;
+        }
+        l->limit.store(limit, std::memory_order_relaxed);
+        l->bucket.set_limit(limit, interval_to_ns(interval, num));
+        if (added) limit_count.store(count + 1, std::memory_order_release);
+    }
+
+    RateLimit* find_limit(RateLimitType type, boost::beast::string_view suffix) {
+        size_t count = limit_count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i)
+            if (limits[i].type == type && boost::beast::iequals(limits[i].header_suffix, suffix)) return &limits[i];
+        return nullptr;
+    }
+
+    static int64_t tokens_for(const RateLimit& l, int64_t weight, bool is_order) {
+        switch (l.type) {
+            case RateLimitType::request_weight: return weight;
+            case RateLimitType::orders: return is_order ? 1 : 0;
+            case RateLimitType::raw_requests: return 1;
+        }
+        return 0;
+    }
+
+public:
+    // defaults are spot limits at the moment of writing, replaced by seed() once exchangeInfo is loaded
+    explicit RateLimiter(double order_reserve = 0.2) : info_share(1.0 - order_reserve) {
+        std::lock_guard<std::mutex> lock(seed_mutex);
+        add_limit(RateLimitType::request_weight, "MINUTE", 1, 6000);
+        add_limit(RateLimitType::orders, "SECOND", 10, 100);
+        add_limit(RateLimitType::orders, "DAY", 1, 200000);
+        add_limit(RateLimitType::raw_requests, "MINUTE", 5, 61000);
+    }
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // limits exchange reports replace defaults with the same type and interval, others are kept
+    // may run while other threads take tokens
+    void seed(const rapidjson::Value& rate_limits) {
+        std::lock_guard<std::mutex> lock(seed_mutex);
+        for (rapidjson::SizeType i = 0; i < rate_limits.Size(); ++i) {
+            const char* type_str = rate_limits[i]["rateLimitType"].GetString();
+            RateLimitType type = RateLimitType::request_weight;
+            if (strcmp(type_str, "ORDERS") == 0) type = RateLimitType::orders;
+            else if (strcmp(type_str, "RAW_REQUESTS") == 0) type = RateLimitType::raw_requests;
+            add_limit(type, rate_limits[i]["interval"].GetString(), rate_limits[i]["intervalNum"].GetInt64(), rate_limits[i]["limit"].GetInt64());
+        }
+    }
+
+    // takes tokens from every limit or from none of them
+    bool try_acquire(RequestPriority priority, int64_t weight, bool is_order = false) {
+        int64_t now = now_ns();
+        if (now < banned_until.load(std::memory_order_relaxed)) return false;
+
+        double share = priority == RequestPriority::order ? 1.0 : info_share;
+        size_t count = limit_count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i) {
+            int64_t tokens = tokens_for(limits[i], weight, is_order);
+            if (tokens == 0 || limits[i].bucket.try_acquire(tokens, now, share)) continue;
+
+            while (i-- > 0) {
+                tokens = tokens_for(limits[i], weight, is_order);
+                if (tokens > 0) limits[i].bucket.release(tokens);
+            }
+            return false;
+        }
+        return true;
+    }
+
+    // 0 if tokens were taken, otherwise ns until request may fit into limits; never waits,
+    // so io threads defer the request on a timer instead
+    [[nodiscard]] int64_t acquire_or_wait(RequestPriority priority, int64_t weight, bool is_order = false) {
+        if (try_acquire(priority, weight, is_order)) return 0;
+        int64_t now = now_ns();
+        double share = priority == RequestPriority::order ? 1.0 : info_share;
+        int64_t wait = std::max<int64_t>(banned_until.load(std::memory_order_relaxed) - now, 1000 * 1000);
+        size_t count = limit_count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i)
+            wait = std::max(wait, limits[i].bucket.wait_ns(tokens_for(limits[i], weight, is_order), now, share));
+        return wait;
+    }
+
+    // sleeps until request fits into limits, only where blocking is fine: startup and threads of their own (time sync, user data stream)
+    void acquire(RequestPriority priority, int64_t weight, bool is_order = false) {
+        while (int64_t wait = acquire_or_wait(priority, weight, is_order))
+            std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+    }
+
+    template<class Body>
+    void on_response(const boost::beast::http::response<Body>& response) {
+        int64_t now = now_ns();
+        static constexpr boost::beast::string_view weight_prefix = "x-mbx-used-weight-";
+        static constexpr boost::beast::string_view orders_prefix = "x-mbx-order-count-";
+
+        for (const auto& field : response) {
+            boost::beast::string_view name = field.name_string();
+            RateLimit* l = nullptr;
+            if (name.size() > weight_prefix.size() && boost::beast::iequals(name.substr(0, weight_prefix.size()), weight_prefix))
+                l = find_limit(RateLimitType::request_weight, name.substr(weight_prefix.size()));
+            else if (name.size() > orders_prefix.size() && boost::beast::iequals(name.substr(0, orders_prefix.size()), orders_prefix))
+                l = find_limit(RateLimitType::orders, name.substr(orders_prefix.size()));
+            if (l) l->bucket.set_used(std::stoll(std::string(field.value())), now);
+        }
+
+        // 429 is a warning, 418 is an ip ban. both tell how long to wait in Retry-After
+        auto status = response.result_int();
+        if (status != 429 && status != 418) return;
+        int64_t retry_s = 60;
+        auto retry_after = response.find(boost::beast::http::field::retry_after);
+        if (retry_after != response.end()) retry_s = std::stoll(std::string(retry_after->value()));
+        banned_until.store(now + retry_s * 1000 * 1000 * 1000, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] size_t size() const { return limit_count.load(std::memory_order_acquire); }
+    [[nodiscard]] const RateLimit& operator[](size_t i) const { return limits[i]; }
+    [[nodiscard]] double usage(size_t i) const { return limits[i].bucket.usage(now_ns()); }
+    [[nodiscard]] bool is_banned() const { return now_ns() < banned_until.load(std::memory_order_relaxed); }
+};
+
+
+#endif //ARB_RATE_LIMIT_H
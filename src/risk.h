@@ -0,0 +1,131 @@
+#ifndef ARB_RISK_H
+#define ARB_RISK_H
+
+#include <cinttypes>
+#include <string>
+#include <array>
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "telemetry.h"
+
+// reasons are bits, one check can fail several of them
+enum RiskReject : uint32_t {
+    risk_notional = 1,
+    risk_position = 2,
+    risk_price_band = 4,
+    risk_order_rate = 8,
+};
+
+struct RiskLimits {
+public:
+    double max_notional = std::numeric_limits<double>::infinity();   // quote amount of one order
+    double max_position = std::numeric_limits<double>::infinity();   // base amount held after a buy fills
+    double price_band = std::numeric_limits<double>::infinity();     // largest |price / reference - 1|
+    double max_order_rate = std::numeric_limits<double>::infinity(); // orders per second, burst of one second
+};
+
+// pre-trade checks before an order leaves the process, so orders the venue would reject or we never
+// want sent don't cost a round trip
+// limits and state of every symbol sit in one flat table slot, so a check only touches its own slot;
+// every limit is evaluated without branching on the others, order rate is a token bucket
+// checks run on strategy thread only, reject counters are atomics for stats from any thread
+// callers check orders that add exposure, exits must never be held back by these limits
+class RiskTable {
+public:
+    static constexpr size_t max_symbols = 64;
+    static constexpr size_t reason_count = 4;
+    static constexpr const char* reason_names[reason_count] = {"notional", "position", "price_band", "order_rate"};
+private:
+    struct alignas(64) Entry {
+    public:
+        RiskLimits limits;
+        double rate_per_ns{};
+        double burst{};
+        double tokens{};
+        int64_t last_ns{};
+        double position{};
+        std::atomic<uint64_t> passed{0};
+        std::array<std::atomic<uint64_t>, reason_count> rejects{};
+    };
+
+    std::array<Entry, max_symbols> entries;
+    std::vector<std::string> names;
+    LatencyHistogram check_time; // ns
+public:
+    RiskTable() = default;
+    RiskTable(const RiskTable&) = delete;
+    RiskTable& operator=(const RiskTable&) = delete;
+
+    // returns slot used by checks, setup only
+    size_t add_symbol(const std::string& symbol) {
+        if (names.size() >= max_symbols) throw std::runtime_error("Risk table is full");
+        names.push_back(symbol);
+        set_limits(names.size() - 1, RiskLimits{});
+        return names.size() - 1;
+    }
+
+    // slot or max_symbols if symbol is not in the table
+    [[nodiscard]] size_t find(const std::string& symbol) const {
+        auto it = std::find(names.begin(), names.end(), symbol);
+        return it == names.end() ? max_symbols : static_cast<size_t>(it - names.begin());
+    }
+
+    void set_limits(size_t slot, const RiskLimits& limits) {
+        Entry& e = entries[slot];
+        e.limits = limits;
+        // unlimited rate stays finite, so refill never multiplies zero by infinity
+        double rate = std::isfinite(limits.max_order_rate) ? limits.max_order_rate : 1e12;
+        e.rate_per_ns = rate / 1e9;
+        e.burst = e.tokens = std::max(1.0, rate);
+    }
+
+    // base amount held, after every fill
+    void set_position(size_t slot, double position) { entries[slot].position = position; }
+
+    // 0 if order may be sent, otherwise RiskReject bits; quantity is base amount, price is expected fill price
+    // and reference is fair price the band is measured from; passed orders take a token of order rate
+    uint32_t check(size_t slot, bool is_buy, double quantity, double price, double reference, int64_t now_ns) {
+        Entry& e = entries[slot];
+        const RiskLimits& l = e.limits;
+        e.tokens = std::min(e.burst, e.tokens + static_cast<double>(now_ns - e.last_ns) * e.rate_per_ns);
+        e.last_ns = now_ns;
+
+        double after = e.position + (is_buy ? quantity : 0);
+        double deviation = std::abs(price / reference - 1);
+        uint32_t result = (quantity * price > l.max_notional) * risk_notional
+                        | (after > l.max_position) * risk_position
+                        | (deviation > l.price_band) * risk_price_band
+                        | (e.tokens < 1) * risk_order_rate;
+        e.tokens -= result == 0;
+
+        if (result == 0) {
+            e.passed.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        for (size_t i = 0; i < reason_count; ++i)
+            if (result & (1u << i)) e.rejects[i].fetch_add(1, std::memory_order_relaxed);
+        return result;
+    }
+
+    void record_check_time(int64_t ns) { check_time.record(static_cast<uint64_t>(std::max<int64_t>(0, ns))); }
+
+    [[nodiscard]] const LatencyHistogram& get_check_time() const { return check_time; }
+    [[nodiscard]] uint64_t get_passed(size_t slot) const { return entries[slot].passed.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t get_rejects(size_t slot, size_t reason) const { return entries[slot].rejects[reason].load(std::memory_order_relaxed); }
+    [[nodiscard]] const RiskLimits& get_limits(size_t slot) const { return entries[slot].limits; }
+
+    // names of RiskReject bits, comma separated
+    static std::string describe(uint32_t result) {
+        std::string out;
+        for (size_t i = 0; i < reason_count; ++i)
+            if (result & (1u << i)) out += (out.empty() ? "" : ",") + std::string(reason_names[i]);
+        return out;
+    }
+};
+
+
+#endif //ARB_RISK_H
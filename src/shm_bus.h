@@ -0,0 +1,245 @@
+#ifndef ARB_SHM_BUS_H
+#define ARB_SHM_BUS_H
+
+#include <cinttypes>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <ctime>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "order_book.h"
+
+// market data bus in shared memory (/dev/shm/<name>): one feed handler process writes book snapshots
+// into a ring, any number of strategy processes read it without locks and without writing to slots
+// every slot is a seqlock stamped with its sequence number, so a reader sees torn or overwritten
+// records and counts them as gaps; records are whole top of the book, so after a gap reader just
+// continues with the next record of its symbol
+// restarted publisher may size the ring differently, readers check magic and generation on every read
+// and map the bus again when generation changes
+class ShmBus {
+public:
+    static constexpr uint64_t magic = 0x4152424255530001; // 'ARBBUS' and layout version
+    static constexpr uint64_t default_capacity = 4096;      // power of two
+protected:
+    struct Slot {
+    public:
+        std::atomic<uint64_t> stamp; // 2 * seq + 1 while written, 2 * seq + 2 when done
+        BookSnapshot data;
+    };
+
+    struct Header {
+    public:
+        std::atomic<uint64_t> magic;      // written last by publisher, 0 while it sets the bus up
+        uint64_t capacity;
+        uint64_t slot_size;
+        std::atomic<int64_t> generation;  // publisher start time, changes when it restarts
+        alignas(64) std::atomic<uint64_t> write_seq;
+        alignas(64) std::atomic<uint32_t> notify;  // futex word, bumped on every publish
+        std::atomic<uint32_t> waiters;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "bus needs address-free 64-bit atomics");
+
+    std::string name;
+    void* memory = MAP_FAILED;
+    size_t size{};
+    Header* header{};
+    Slot* slots{};
+    uint64_t mask{};
+protected:
+    static size_t size_for(uint64_t capacity) { return sizeof(Header) + capacity * sizeof(Slot); }
+
+    // replaces current mapping, if any
+    void map(int fd, size_t bytes) {
+        void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) throw std::runtime_error("Failed to map market data bus '" + name + "'");
+        if (memory != MAP_FAILED) munmap(memory, size);
+        memory = mapped;
+        size = bytes;
+        header = static_cast<Header*>(memory);
+        slots = reinterpret_cast<Slot*>(static_cast<char*>(memory) + sizeof(Header));
+    }
+
+#ifdef __linux__
+    // futex on shared mapping, so it wakes readers in other processes
+    static void futex_wait(std::atomic<uint32_t>& word, uint32_t value, std::chrono::nanoseconds timeout) {
+        timespec ts{static_cast<time_t>(timeout.count() / 1000000000), static_cast<long>(timeout.count() % 1000000000)};
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, value, &ts, nullptr, 0);
+    }
+
+    static void futex_wake(std::atomic<uint32_t>& word) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+#endif
+
+    explicit ShmBus(std::string name) : name(std::move(name)) {
+        if (this->name.empty() || this->name[0] != '/') this->name.insert(0, "/");
+    }
+
+public:
+    ShmBus(const ShmBus&) = delete;
+    ShmBus& operator=(const ShmBus&) = delete;
+
+    ~ShmBus() {
+        if (memory != MAP_FAILED) munmap(memory, size);
+    }
+
+    [[nodiscard]] const std::string& get_name() const { return name; }
+};
+
+class ShmPublisher : public ShmBus {
+public:
+    explicit ShmPublisher(const std::string& name, uint64_t capacity = default_capacity) : ShmBus(name) {
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0) throw std::runtime_error("Market data bus capacity must be a power of two");
+        int fd = shm_open(this->name.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd < 0) throw std::runtime_error("Failed to open market data bus '" + this->name + "'");
+        // readers of previous publisher see magic 0 and wait for the new generation; nothing waits for reads
+        // already running, so the object only ever grows and their mappings stay backed
+        struct stat st{};
+        size_t bytes = size_for(capacity);
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+            map(dup(fd), sizeof(Header));
+            header->magic.store(0, std::memory_order_release);
+            bytes = std::max(bytes, static_cast<size_t>(st.st_size));
+        }
+        if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to size market data bus '" + this->name + "'");
+        }
+        map(fd, bytes);
+
+        // readers see new generation only after layout is complete
+        header->magic.store(0, std::memory_order_relaxed);
+        header->capacity = capacity;
+        header->slot_size = sizeof(Slot);
+        header->generation.store(std::chrono::system_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        header->write_seq.store(0, std::memory_order_relaxed);
+        for (uint64_t i = 0; i < capacity; ++i) slots[i].stamp.store(0, std::memory_order_relaxed);
+        mask = capacity - 1;
+        header->magic.store(magic, std::memory_order_release);
+    }
+
+    // single writer
+    void publish(const BookSnapshot& s) {
+        uint64_t seq = header->write_seq.load(std::memory_order_relaxed);
+        Slot& slot = slots[seq & mask];
+        slot.stamp.store(2 * seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&slot.data, &s, sizeof(BookSnapshot));
+        slot.stamp.store(2 * seq + 2, std::memory_order_release);
+        header->write_seq.store(seq + 1, std::memory_order_release);
+#ifdef __linux__
+        header->notify.fetch_add(1, std::memory_order_release);
+        if (header->waiters.load(std::memory_order_acquire) > 0) futex_wake(header->notify);
+#endif
+    }
+
+    [[nodiscard]] uint64_t get_sequence() const { return header->write_seq.load(std::memory_order_relaxed); }
+
+    // removes the name, mapped readers keep working until they reopen
+    void unlink() { shm_unlink(name.c_str()); }
+};
+
+class ShmSubscriber : public ShmBus {
+private:
+    uint64_t next_seq{};
+    int64_t generation{};
+    std::atomic<uint64_t> gaps{0};     // written by reader thread only, atomic for stats
+    std::atomic<uint64_t> received{0};
+private:
+    // maps the bus and starts at current end of ring; false, or exception when required, if bus is missing,
+    // not set up yet or has another layout
+    bool open(bool required) {
+        auto fail = [&](const std::string& reason) {
+            if (required) throw std::runtime_error("Market data bus '" + this->name + "' " + reason);
+            return false;
+        };
+        int fd = shm_open(this->name.c_str(), O_RDWR, 0);
+        if (fd < 0) return fail("does not exist, start feed handler first");
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+            ::close(fd);
+            return fail("is not ready");
+        }
+        map(fd, static_cast<size_t>(st.st_size));
+        if (header->magic.load(std::memory_order_acquire) != magic) return fail("is not ready");
+        if (header->slot_size != sizeof(Slot) || header->capacity == 0 || size < size_for(header->capacity))
+            throw std::runtime_error("Market data bus '" + this->name + "' has different layout");
+        mask = header->capacity - 1;
+        generation = header->generation.load(std::memory_order_acquire);
+        next_seq = header->write_seq.load(std::memory_order_acquire);
+        return true;
+    }
+public:
+    // starts at current end of ring, older records may already be stale
+    explicit ShmSubscriber(const std::string& name) : ShmBus(name) { open(true); }
+
+    // false when there is nothing new
+    bool next(BookSnapshot& out) {
+        // publisher is restarting, or restarted with a ring of its own; its sequence started over
+        if (header->magic.load(std::memory_order_acquire) != magic) return false;
+        if (header->generation.load(std::memory_order_acquire) != generation) {
+            if (!open(false)) return false;
+            gaps++;
+        }
+        for (;;) {
+            uint64_t head = header->write_seq.load(std::memory_order_acquire);
+            if (next_seq >= head) return false;
+            if (head - next_seq > header->capacity) { // reader fell behind by whole ring
+                gaps += head - header->capacity - next_seq;
+                next_seq = head - header->capacity;
+            }
+
+            Slot& slot = slots[next_seq & mask];
+            uint64_t before = slot.stamp.load(std::memory_order_acquire);
+            if (before != 2 * next_seq + 2) { // overwritten by newer record or still being written
+                if (before == 2 * next_seq + 1) return false;
+                gaps++;
+                next_seq++;
+                continue;
+            }
+            std::memcpy(&out, &slot.data, sizeof(BookSnapshot));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t after = slot.stamp.load(std::memory_order_relaxed);
+            next_seq++;
+            if (after != before) { // torn by writer lapping us
+                gaps++;
+                continue;
+            }
+            received.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // sleeps until publisher writes something or timeout passes
+    void wait(std::chrono::nanoseconds timeout) {
+#ifdef __linux__
+        uint32_t value = header->notify.load(std::memory_order_acquire);
+        if (next_seq < header->write_seq.load(std::memory_order_acquire)) return;
+        header->waiters.fetch_add(1, std::memory_order_acq_rel);
+        futex_wait(header->notify, value, timeout);
+        header->waiters.fetch_sub(1, std::memory_order_acq_rel);
+#else
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, std::chrono::microseconds(100)));
+#endif
+    }
+
+    [[nodiscard]] uint64_t get_gaps() const { return gaps.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t get_received() const { return received.load(std::memory_order_relaxed); }
+};
+
+
+#endif //ARB_SHM_BUS_H
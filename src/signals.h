@@ -0,0 +1,284 @@
+#ifndef ARB_SIGNALS_H
+#define ARB_SIGNALS_H
+
+#include <cinttypes>
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include "order_book.h"
+
+// incremental market signals: every update is O(1) and nothing allocates after construction
+// windows are counted in updates (ticks), not in time, and live in fixed capacity ring buffers
+
+// newest Capacity values, pushing into a full ring overwrites the oldest one
+template<class T, size_t Capacity>
+class RingBuffer {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+private:
+    std::array<T, Capacity> items{};
+    size_t head{}; // next write
+    size_t count{};
+public:
+    // returns the overwritten value, or T{} while ring is not full
+    T push(const T& v) {
+        T evicted = count == Capacity ? items[head] : T{};
+        items[head] = v;
+        head = (head + 1) & (Capacity - 1);
+        if (count < Capacity) count++;
+        return evicted;
+    }
+
+    void clear() { head = count = 0; }
+
+    // 0 is the newest value
+    [[nodiscard]] const T& operator[](size_t age) const { return items[(head + Capacity - 1 - age) & (Capacity - 1)]; }
+    [[nodiscard]] const T& newest() const { return (*this)[0]; }
+    [[nodiscard]] const T& oldest() const { return (*this)[count - 1]; }
+    [[nodiscard]] size_t size() const { return count; }
+    [[nodiscard]] bool empty() const { return count == 0; }
+    [[nodiscard]] bool full() const { return count == Capacity; }
+    static constexpr size_t capacity() { return Capacity; }
+};
+
+// exponential moving average, alpha = 2 / (span + 1)
+class Ema {
+private:
+    double alpha;
+    double current{};
+    bool ready{};
+public:
+    explicit Ema(double span) : alpha(2.0 / (span + 1)) { }
+
+    void update(double v) {
+        current = ready ? current + alpha * (v - current) : v;
+        ready = true;
+    }
+
+    [[nodiscard]] double value() const { return current; }
+    [[nodiscard]] bool is_ready() const { return ready; }
+};
+
+// mean and variance of the last Window values from running sums
+// values are stored relative to the first one, so sums of large prices keep their precision
+// sums are recomputed from the ring every Window updates, so rounding errors of add and subtract don't pile up
+template<size_t Window>
+class RollingStats {
+private:
+    RingBuffer<double, Window> values;
+    double shift{};
+    bool shifted{};
+    double sum{};
+    double sum_sq{};
+    size_t since_recompute{};
+private:
+    void recompute() {
+        sum = sum_sq = 0;
+        for (size_t i = 0; i < values.size(); ++i) {
+            sum += values[i];
+            sum_sq += values[i] * values[i];
+        }
+        since_recompute = 0;
+    }
+public:
+    void update(double v) {
+        if (!shifted) {
+            shift = v;
+            shifted = true;
+        }
+        v -= shift;
+        double evicted = values.push(v);
+        sum += v - evicted;
+        sum_sq += v * v - evicted * evicted;
+        if (++since_recompute == Window) recompute();
+    }
+
+    [[nodiscard]] double mean() const { return values.empty() ? 0 : shift + sum / static_cast<double>(values.size()); }
+
+    // sample variance, 0 until there are two values
+    [[nodiscard]] double variance() const {
+        auto n = static_cast<double>(values.size());
+        if (n < 2) return 0;
+        return std::max(0.0, (sum_sq - sum * sum / n) / (n - 1));
+    }
+
+    [[nodiscard]] double stddev() const { return std::sqrt(variance()); }
+    [[nodiscard]] size_t size() const { return values.size(); }
+    [[nodiscard]] bool is_ready() const { return values.full(); }
+};
+
+// standard deviation of relative changes over the last Window updates of a price
+template<size_t Window>
+class RollingVolatility {
+private:
+    RollingStats<Window> returns;
+    double last{};
+public:
+    void update(double price) {
+        if (price <= 0) return;
+        if (last > 0) returns.update(price / last - 1);
+        last = price;
+    }
+
+    [[nodiscard]] double value() const { return returns.stddev(); }
+    [[nodiscard]] bool is_ready() const { return returns.is_ready(); }
+};
+
+// threshold for relative price moves that follows realized volatility: multiplier * volatility, within bounds
+// fixed threshold is used while disabled (multiplier 0) and until the window is full
+template<size_t Window>
+class AdaptiveThreshold {
+private:
+    RollingVolatility<Window> volatility;
+    double fixed;
+    double multiplier{};
+    double min{};
+    double max{};
+public:
+    explicit AdaptiveThreshold(double fixed) : fixed(fixed) { }
+
+    void enable(double multiplier, double min, double max) {
+        this->multiplier = multiplier;
+        this->min = min;
+        this->max = std::max(min, max);
+    }
+
+    void update(double price) { volatility.update(price); }
+
+    [[nodiscard]] double value() const {
+        if (!is_warm()) return fixed;
+        return std::clamp(multiplier * volatility.value(), min, max);
+    }
+
+    [[nodiscard]] double get_fixed() const { return fixed; }
+    [[nodiscard]] double get_volatility() const { return volatility.value(); }
+    [[nodiscard]] bool is_enabled() const { return multiplier > 0; }
+    [[nodiscard]] bool is_warm() const { return is_enabled() && volatility.is_ready(); }
+};
+
+// volume weighted average price of the last Window trades, sums are recomputed every Window trades like in RollingStats
+template<size_t Window>
+class RollingVwap {
+private:
+    struct Fill {
+    public:
+        double notional;
+        double quantity;
+    };
+
+    RingBuffer<Fill, Window> fills;
+    double notional{};
+    double quantity{};
+    size_t since_recompute{};
+private:
+    void recompute() {
+        notional = quantity = 0;
+        for (size_t i = 0; i < fills.size(); ++i) {
+            notional += fills[i].notional;
+            quantity += fills[i].quantity;
+        }
+        since_recompute = 0;
+    }
+public:
+    void update(double price, double qty) {
+        Fill evicted = fills.push(Fill{price * qty, qty});
+        notional += price * qty - evicted.notional;
+        quantity += qty - evicted.quantity;
+        if (++since_recompute == Window) recompute();
+    }
+
+    [[nodiscard]] double value() const { return quantity > 0 ? notional / quantity : 0; }
+    [[nodiscard]] double get_quantity() const { return quantity; }
+    [[nodiscard]] bool is_ready() const { return fills.full(); }
+};
+
+// (bought - sold) / (bought + sold) over the last Window trades, by aggressor side, in -1..1
+// sums are recomputed every Window trades like in RollingStats
+template<size_t Window>
+class TradeFlowImbalance {
+private:
+    RingBuffer<double, Window> flow; // signed quantity, positive when buyer was the taker
+    double buys{};
+    double sells{};
+    size_t since_recompute{};
+private:
+    void recompute() {
+        buys = sells = 0;
+        for (size_t i = 0; i < flow.size(); ++i)
+            if (flow[i] > 0) buys += flow[i]; else sells -= flow[i];
+        since_recompute = 0;
+    }
+public:
+    void update(double qty, bool buyer_is_taker) {
+        double evicted = flow.push(buyer_is_taker ? qty : -qty);
+        if (buyer_is_taker) buys += qty; else sells += qty;
+        if (evicted > 0) buys -= evicted; else sells += evicted;
+        if (++since_recompute == Window) recompute();
+    }
+
+    [[nodiscard]] double value() const { return buys + sells > 0 ? (buys - sells) / (buys + sells) : 0; }
+    [[nodiscard]] bool is_ready() const { return flow.full(); }
+};
+
+// (bid quantity - ask quantity) / both over the top levels of the book, in -1..1
+inline double book_imbalance(const OrderBook& book, size_t levels = 5) {
+    const auto& bids = book.get_bids();
+    const auto& asks = book.get_asks();
+    double b = 0, a = 0;
+    for (size_t i = 0; i < std::min(levels, bids.size()); ++i) b += bids[i].quantity;
+    for (size_t i = 0; i < std::min(levels, asks.size()); ++i) a += asks[i].quantity;
+    return a + b > 0 ? (b - a) / (a + b) : 0;
+}
+
+// mid price weighted towards the side with less quantity, where price is more likely to move; 0 on empty side
+inline double microprice(const OrderBook& book) {
+    const auto& bids = book.get_bids();
+    const auto& asks = book.get_asks();
+    if (bids.empty() || asks.empty()) return 0;
+    const BookLevel& b = bids.front();
+    const BookLevel& a = asks.front();
+    return (b.price * a.quantity + a.price * b.quantity) / (a.quantity + b.quantity);
+}
+
+// signals strategy keeps for its symbol: book ones are updated on every book change, trade ones on every trade
+// window sizes are fixed at compile time, so the whole set is one flat object
+template<size_t BookWindow = 256, size_t TradeWindow = 256>
+class MarketSignals {
+private:
+    Ema mid_ema;
+    RollingVolatility<BookWindow> volatility;
+    RollingVwap<TradeWindow> vwap;
+    TradeFlowImbalance<TradeWindow> trade_flow;
+    double mid{};
+    double micro{};
+    double imbalance{};
+public:
+    explicit MarketSignals(double ema_span = BookWindow) : mid_ema(ema_span) { }
+
+    void on_book(const OrderBook& book) {
+        const auto& bids = book.get_bids();
+        const auto& asks = book.get_asks();
+        if (bids.empty() || asks.empty()) return;
+        mid = (bids.front().price + asks.front().price) / 2;
+        micro = microprice(book);
+        imbalance = book_imbalance(book);
+        mid_ema.update(mid);
+        volatility.update(mid);
+    }
+
+    void on_trade(double price, double qty, bool buyer_is_taker) {
+        vwap.update(price, qty);
+        trade_flow.update(qty, buyer_is_taker);
+    }
+
+    [[nodiscard]] double get_mid() const { return mid; }
+    [[nodiscard]] double get_mid_ema() const { return mid_ema.value(); }
+    [[nodiscard]] double get_microprice() const { return micro; }
+    [[nodiscard]] double get_book_imbalance() const { return imbalance; }
+    [[nodiscard]] double get_volatility() const { return volatility.value(); }
+    [[nodiscard]] bool is_volatility_ready() const { return volatility.is_ready(); }
+    [[nodiscard]] double get_vwap() const { return vwap.value(); }
+    [[nodiscard]] double get_trade_flow() const { return trade_flow.value(); }
+};
+
+
+#endif //ARB_SIGNALS_H
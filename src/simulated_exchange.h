@@ -0,0 +1,99 @@
+#ifndef ARB_SIMULATED_EXCHANGE_H
+#define ARB_SIMULATED_EXCHANGE_H
+
+#include <cinttypes>
+#include <string>
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <optional>
+#include <unordered_map>
+#include "exchange.h"
+#include "telemetry.h"
+
+// local venue for paper trading: market data and symbol metadata come from real venue Market,
+// market orders are filled right away against the book strategy keeps, nothing is sent out
+// fills are ready when new_market_order returns, so order callback is never called
+template<class Market>
+class SimulatedExchange : public Exchange<SimulatedExchange<Market>> {
+    friend class Exchange<SimulatedExchange<Market>>;
+private:
+    Market market;
+    std::unordered_map<std::string, const OrderBook*> books;
+    std::unordered_map<int64_t, OrderUpdate> fills;
+    int64_t next_order_id = 1;
+private:
+    [[nodiscard]] std::string depth_stream_impl(const std::string& symbol) const { return market.depth_stream(symbol); }
+    bool update_ids_impl(const rapidjson::Value& event, uint64_t& first_id, uint64_t& final_id) const { return market.update_ids(event, first_id, final_id); }
+    bool parse_depth_impl(const rapidjson::Value& event, DepthUpdate& out) const { return market.parse_depth(event, out); }
+    [[nodiscard]] std::string trade_stream_impl(const std::string& symbol, bool aggregate) const { return market.trade_stream(symbol, aggregate); }
+    bool parse_trade_impl(const rapidjson::Value& event, Trade& out) const { return market.parse_trade(event, out); }
+    BookLoad load_book_impl(const std::string& symbol, DepthUpdate& out) { return market.load_book(symbol, out); }
+
+    void watch_book_impl(const std::string& symbol, const OrderBook& book) { books[symbol] = &book; }
+
+    // walks the opposite side until quantity (or quote amount) is filled, rest of the order expires
+    OrderAck new_market_order_impl(const std::string& symbol, bool is_buy, double quantity, bool quote_quantity) {
+        auto start = std::chrono::steady_clock::now();
+        OrderAck ack;
+        ack.sent = true;
+        auto it = books.find(symbol);
+        if (it == books.end()) {
+            std::cout << "simulated venue has no book of " << symbol << std::endl;
+            return ack;
+        }
+
+        const std::vector<BookLevel>& levels = is_buy ? it->second->get_asks() : it->second->get_bids();
+        double executed = 0;
+        double cum_quote = 0;
+        for (auto& l : levels) {
+            double left = quote_quantity ? (quantity - cum_quote) / l.price : quantity - executed;
+            if (left <= 0) break;
+            double take = std::min(l.quantity, left);
+            executed += take;
+            cum_quote += take * l.price;
+        }
+        bool complete = (quote_quantity ? quantity - cum_quote : quantity - executed) <= quantity * 1e-9;
+        OrderState state = complete ? OrderState::filled : executed > 0 ? OrderState::canceled : OrderState::rejected;
+
+        int64_t order_id = next_order_id++;
+        ack.order_id = order_id;
+        ack.transact_ms = (MessageTimes::now() + this->get_clock_offset_us() * 1000) / 1000000;
+        std::ostringstream raw;
+        raw.precision(12);
+        raw << R"({"symbol":")" << symbol << R"(","orderId":)" << order_id << R"(,"transactTime":)" << ack.transact_ms << "}";
+        ack.raw = raw.str();
+        std::ostringstream report;
+        report.precision(12);
+        report << R"({"e":"executionReport","s":")" << symbol << R"(","S":")" << (is_buy ? "BUY" : "SELL") << R"(","i":)" << order_id
+               << R"(,"X":")" << state << R"(","z":")" << executed << R"(","Z":")" << cum_quote << "\"}";
+        fills[order_id] = OrderUpdate{state, executed, cum_quote, report.str()};
+        ack.round_trip = std::chrono::steady_clock::now() - start;
+        return ack;
+    }
+
+    std::optional<OrderUpdate> take_order_update_impl(int64_t order_id) {
+        auto it = fills.find(order_id);
+        if (it == fills.end()) return std::nullopt;
+        OrderUpdate update = std::move(it->second);
+        fills.erase(it);
+        return update;
+    }
+
+    void set_order_callback_impl(std::function<void()>) { }
+
+    void load_symbols_impl(std::unordered_map<std::string, SymbolInfo>& out) { market.load_symbols(out); }
+    [[nodiscard]] int64_t get_clock_offset_us_impl() const { return market.get_clock_offset_us(); }
+    [[nodiscard]] const RateLimiter* get_rate_limiter_impl() const { return market.get_rate_limiter(); }
+    void close_impl() { market.close(); }
+
+public:
+    // arguments are passed to market venue, which is used without api keys
+    template<class... MarketArgs>
+    explicit SimulatedExchange(MarketArgs&&... market_args) : market(std::forward<MarketArgs>(market_args)...) { }
+
+    [[maybe_unused]] const Market& get_market() const { return market; }
+};
+
+
+#endif //ARB_SIMULATED_EXCHANGE_H
@@ -0,0 +1,180 @@
+#ifndef ARB_SUBSCRIPTION_MANAGER_H
+#define ARB_SUBSCRIPTION_MANAGER_H
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include "feed_supervisor.h"
+
+// streams of one endpoint spread over as many connections as needed, each connection is a FeedSupervisor
+// with its own reconnects and request pacing; new stream goes to the least loaded connection
+// rebalance moves streams from fuller connections to emptier ones, stream is dropped from old connection
+// only after exchange replied to its subscription on new one, so for a moment both deliver it and consumer
+// must skip repeated update ids (order book does)
+// must be used on io thread
+class SubscriptionManager {
+private:
+    net::io_context& io;
+    net::ssl::context& ssl;
+    std::string host;
+    std::string target;
+    FeedSupervisor::MessageHandler handler;
+    size_t streams_per_connection;
+    std::vector<std::unique_ptr<FeedSupervisor>> connections;
+    std::unordered_map<std::string, size_t> owners; // stream to connection index
+    std::unordered_map<std::string, size_t> moving; // stream to connection it is leaving, until new one confirms it
+    bool started{};
+    bool rx_timestamps{};
+private:
+    size_t add_connection() {
+        connections.push_back(std::make_unique<FeedSupervisor>(io, ssl, host, target, handler));
+        connections.back()->set_rx_timestamps(rx_timestamps);
+        if (started) connections.back()->start();
+        return connections.size() - 1;
+    }
+
+    // streams connection keeps, ones moving away from it are not counted
+    size_t load(size_t i) const {
+        size_t n = connections[i]->get_streams().size();
+        for (auto& [stream, from] : moving) n -= from == i;
+        return n;
+    }
+
+    size_t least_loaded() const {
+        size_t best = connections.size();
+        size_t best_load = 0;
+        for (size_t i = 0; i < connections.size(); ++i) {
+            size_t n = load(i);
+            // moving streams still take room on the connection they are leaving
+            if (connections[i]->get_streams().size() >= streams_per_connection) continue;
+            if (best == connections.size() || n < best_load) {
+                best = i;
+                best_load = n;
+            }
+        }
+        return best;
+    }
+
+    // stream stays on old connection until new one confirms it, refused one goes back to old
+    // false if new connection took nothing (full or already has stream), then nothing changes
+    bool move(const std::string& stream, size_t from, size_t to) {
+        bool sent = connections[to]->subscribe(stream, [this, stream, from, to](bool ok) {
+            auto it = moving.find(stream);
+            if (it == moving.end() || it->second != from) return;
+            moving.erase(it);
+            if (ok) {
+                connections[from]->unsubscribe(stream);
+                return;
+            }
+            connections[to]->unsubscribe(stream);
+            owners[stream] = from;
+        });
+        if (!sent) return false;
+        moving[stream] = from;
+        owners[stream] = to;
+        return true;
+    }
+
+public:
+    SubscriptionManager(net::io_context& io, net::ssl::context& ssl, std::string host, std::string target, FeedSupervisor::MessageHandler handler, size_t streams_per_connection = FeedSupervisor::max_streams) :
+            io(io),
+            ssl(ssl),
+            host(std::move(host)),
+            target(std::move(target)),
+            handler(std::move(handler)),
+            streams_per_connection(std::clamp<size_t>(streams_per_connection, 1, FeedSupervisor::max_streams))
+    { }
+
+    SubscriptionManager(const SubscriptionManager&) = delete;
+    SubscriptionManager& operator=(const SubscriptionManager&) = delete;
+
+    void start() {
+        started = true;
+        if (connections.empty()) add_connection();
+        for (auto& c : connections) c->start();
+    }
+
+    void set_rx_timestamps(bool enable) {
+        rx_timestamps = enable;
+        for (auto& c : connections) c->set_rx_timestamps(enable);
+    }
+
+    // false if stream is already subscribed
+    bool subscribe(const std::string& stream) {
+        if (owners.count(stream)) return false;
+        size_t i = least_loaded();
+        if (i == connections.size()) i = add_connection();
+        connections[i]->subscribe(stream);
+        owners.emplace(stream, i);
+        return true;
+    }
+
+    bool unsubscribe(const std::string& stream) {
+        auto it = owners.find(stream);
+        if (it == owners.end()) return false;
+        connections[it->second]->unsubscribe(stream);
+        owners.erase(it);
+        auto from = moving.find(stream);
+        if (from != moving.end()) {
+            connections[from->second]->unsubscribe(stream);
+            moving.erase(from);
+        }
+        return true;
+    }
+
+    // evens out stream count, connections left without streams stay open for later subscriptions
+    // returns number of moved streams
+    size_t rebalance() {
+        if (connections.empty()) return 0;
+        size_t needed = (owners.size() + streams_per_connection - 1) / streams_per_connection;
+        while (connections.size() < needed) add_connection();
+        size_t target_count = (owners.size() + connections.size() - 1) / connections.size();
+
+        size_t moved = 0;
+        for (size_t from = 0; from < connections.size(); ++from) {
+            const std::vector<std::string>& list = connections[from]->get_streams();
+            for (size_t k = list.size(); k-- > 0 && load(from) > target_count;) {
+                if (moving.count(list[k])) continue;
+                size_t to = least_loaded();
+                if (to == connections.size() || to == from || load(to) + 1 >= load(from)) break;
+                if (!move(std::string(list[k]), from, to)) break;
+                moved++;
+            }
+        }
+        return moved;
+    }
+
+    // streams exchange reports for every connection, printed as replies come
+    void print_subscriptions() {
+        for (size_t i = 0; i < connections.size(); ++i) {
+            connections[i]->list_subscriptions([this, i](const std::vector<std::string>& list) {
+                std::cout << host << " connection " << i << ": " << list.size() << " streams on exchange, " << connections[i]->get_streams().size() << " wanted" << std::endl;
+            });
+        }
+    }
+
+    void close() {
+        for (auto& c : connections) c->close();
+    }
+
+    [[nodiscard]] bool is_connected() const {
+        return !connections.empty() && std::all_of(connections.begin(), connections.end(), [](auto& c) { return c->is_connected(); });
+    }
+
+    [[nodiscard]] uint64_t get_reconnects() const {
+        uint64_t sum = 0;
+        for (auto& c : connections) sum += c->get_reconnects();
+        return sum;
+    }
+
+    [[nodiscard]] size_t stream_count() const { return owners.size(); }
+    [[nodiscard]] size_t connection_count() const { return connections.size(); }
+    [[nodiscard]] const std::string& get_host() const { return host; }
+};
+
+
+#endif //ARB_SUBSCRIPTION_MANAGER_H
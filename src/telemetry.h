@@ -0,0 +1,200 @@
+#ifndef ARB_TELEMETRY_H
+#define ARB_TELEMETRY_H
+
+#include <cinttypes>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+// timestamps of a single market data message, all in unix nanoseconds of local clock
+// exchange time is in milliseconds of exchange clock
+struct MessageTimes {
+public:
+    int64_t exchange_ms{};   // event time 'E'
+    int64_t kernel_rx_ns{};  // 0 when kernel timestamps are not available
+    int64_t nic_rx_ns{};     // nic clock, not comparable with others
+    int64_t local_rx_ns{};   // read completed in user space
+    int64_t parsed_ns{};
+    int64_t processed_ns{};
+
+    static int64_t now() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count(); }
+};
+
+// log-linear histogram of nanosecond values: exact below 16, then 16 buckets per power of two (~6% error)
+// counts are atomic, so it is recorded from one thread and read from any other
+class LatencyHistogram {
+public:
+    static constexpr int sub_bits = 4;
+    static constexpr int sub_count = 1 << sub_bits;
+    static constexpr size_t bucket_count = sub_count + (64 - sub_bits) * sub_count;
+private:
+    std::array<std::atomic<uint64_t>, bucket_count> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+public:
+    static size_t bucket_of(uint64_t v) {
+        if (v < sub_count) return static_cast<size_t>(v);
+        int msb = 63 - __builtin_clzll(v);
+        return sub_count + static_cast<size_t>(msb - sub_bits) * sub_count + ((v >> (msb - sub_bits)) & (sub_count - 1));
+    }
+
+    // middle of bucket range
+    static uint64_t value_of(size_t bucket) {
+        if (bucket < sub_count) return bucket;
+        int msb = static_cast<int>((bucket - sub_count) / sub_count) + sub_bits;
+        uint64_t sub = (bucket - sub_count) % sub_count;
+        uint64_t low = (sub_count + sub) << (msb - sub_bits);
+        return low + (1ull << (msb - sub_bits)) / 2;
+    }
+
+    void record(uint64_t v) {
+        buckets[bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(v, std::memory_order_relaxed);
+        uint64_t m = max.load(std::memory_order_relaxed);
+        while (v > m && !max.compare_exchange_weak(m, v, std::memory_order_relaxed)) { }
+    }
+
+    void reset() {
+        for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    // adds counts of other histogram, used to merge windows for a report
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < bucket_count; ++i) buckets[i].fetch_add(other.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        count.fetch_add(other.get_count(), std::memory_order_relaxed);
+        sum.fetch_add(other.sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        uint64_t m = other.get_max();
+        if (m > max.load(std::memory_order_relaxed)) max.store(m, std::memory_order_relaxed);
+    }
+
+    // p in 0..1, nearest rank: bucket of the ceil(p * count)-th smallest sample, so stats and metrics agree
+    // and small samples don't understate the tail (p99 of 10 samples is the largest one, not the 9th)
+    [[nodiscard]] uint64_t percentile(double p) const {
+        uint64_t total = get_count();
+        if (total == 0) return 0;
+        auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * static_cast<double>(total))));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) return value_of(i);
+        }
+        return get_max();
+    }
+
+    [[nodiscard]] uint64_t get_count() const { return count.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t get_sum() const { return sum.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t get_max() const { return max.load(std::memory_order_relaxed); }
+    [[nodiscard]] double mean() const { uint64_t c = get_count(); return c > 0 ? static_cast<double>(get_sum()) / static_cast<double>(c) : 0; }
+    [[nodiscard]] uint64_t get_bucket(size_t i) const { return buckets[i].load(std::memory_order_relaxed); }
+};
+
+// histogram over last one or two windows: recording goes to the window of current time,
+// stale window is cleared when time moves into it
+class RollingHistogram {
+private:
+    std::chrono::nanoseconds window;
+    std::array<LatencyHistogram, 2> windows;
+    std::array<std::atomic<int64_t>, 2> epochs{};
+    std::atomic<uint64_t> negative{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> recorded{0}; // lifetime count and sum of recorded values
+    std::atomic<uint64_t> sum{0};
+private:
+    [[nodiscard]] int64_t current_epoch() const { return std::chrono::steady_clock::now().time_since_epoch() / window; }
+public:
+    explicit RollingHistogram(std::chrono::nanoseconds window = std::chrono::seconds(60)) : window(window) { }
+
+    // negative values come from clock error, they are counted but not recorded
+    void record(int64_t v) {
+        total.fetch_add(1, std::memory_order_relaxed);
+        if (v < 0) {
+            negative.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        recorded.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(static_cast<uint64_t>(v), std::memory_order_relaxed);
+        int64_t epoch = current_epoch();
+        size_t i = static_cast<size_t>(epoch & 1);
+        if (epochs[i].load(std::memory_order_relaxed) != epoch) {
+            windows[i].reset();
+            epochs[i].store(epoch, std::memory_order_relaxed);
+        }
+        windows[i].record(static_cast<uint64_t>(v));
+    }
+
+    // merges current and previous window into 'out'
+    void snapshot(LatencyHistogram& out) const {
+        out.reset();
+        int64_t epoch = current_epoch();
+        for (size_t i = 0; i < windows.size(); ++i)
+            if (epochs[i].load(std::memory_order_relaxed) >= epoch - 1) out.merge(windows[i]);
+    }
+
+    [[nodiscard]] uint64_t get_negative() const { return negative.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t get_total() const { return total.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t get_recorded() const { return recorded.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t get_sum() const { return sum.load(std::memory_order_relaxed); }
+};
+
+// latency of market data and orders, for live inspection
+struct Telemetry {
+public:
+    RollingHistogram feed_latency;    // local receive minus exchange event time, raw clocks
+    RollingHistogram one_way_delay;   // same, but local clock corrected to exchange clock
+    RollingHistogram kernel_to_user;  // kernel receive to read completion, includes tls and websocket decoding
+    RollingHistogram parse_time;      // read completion to parsed json
+    RollingHistogram queue_time;      // parsed json to start of strategy work
+    RollingHistogram process_time;    // strategy work
+    RollingHistogram drain_lag;       // receive of oldest conflated message to start of its drain
+    RollingHistogram bus_delay;       // feed handler publish to read from market data bus
+    RollingHistogram order_round_trip;
+    RollingHistogram order_kernel_to_user; // kernel receive of order response to parsed response
+    RollingHistogram order_one_way;   // exchange transact time minus corrected send time
+
+    template<class F>
+    void for_each(F&& f) const {
+        f("feed_latency", feed_latency);
+        f("one_way_delay", one_way_delay);
+        f("kernel_to_user", kernel_to_user);
+        f("parse_time", parse_time);
+        f("queue_time", queue_time);
+        f("process_time", process_time);
+        f("drain_lag", drain_lag);
+        f("bus_delay", bus_delay);
+        f("order_round_trip", order_round_trip);
+        f("order_kernel_to_user", order_kernel_to_user);
+        f("order_one_way", order_one_way);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const Telemetry& t) {
+        os << "Telemetry (us) {";
+        LatencyHistogram h;
+        t.for_each([&](const char* name, const RollingHistogram& r) {
+            r.snapshot(h);
+            os << "\n\t" << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(1)
+               << " count: " << std::setw(8) << h.get_count()
+               << " mean: " << std::setw(9) << h.mean() / 1000
+               << " p50: " << std::setw(9) << static_cast<double>(h.percentile(0.5)) / 1000
+               << " p99: " << std::setw(9) << static_cast<double>(h.percentile(0.99)) / 1000
+               << " p99.9: " << std::setw(9) << static_cast<double>(h.percentile(0.999)) / 1000
+               << " max: " << std::setw(9) << static_cast<double>(h.get_max()) / 1000
+               << " negative: " << r.get_negative();
+        });
+        os << "\n}";
+        os.unsetf(std::ios_base::floatfield);
+        return os;
+    }
+};
+
+
+#endif //ARB_TELEMETRY_H
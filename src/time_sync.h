@@ -0,0 +1,195 @@
+#ifndef ARB_TIME_SYNC_H
+#define ARB_TIME_SYNC_H
+
+#include <cinttypes>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <iostream>
+#include <algorithm>
+#include "../include/rapidjson/document.h"
+#include "web.h"
+#include "rate_limit.h"
+
+struct TimeSample {
+public:
+    int64_t local_us;  // local system time in the middle of request
+    int64_t offset_us; // exchange time minus local time
+    int64_t rtt_us;
+};
+
+// estimates offset and drift of local clock against exchange clock, NTP style
+// every round sends a burst of /api/v3/time requests and keeps only the one with minimum round trip,
+// because it has the smallest asymmetry error. drift is a least squares fit over kept samples
+// offset is republished often, so readers only need one atomic load to get exchange time
+class TimeSync {
+private:
+    static constexpr size_t max_samples = 32;
+    static constexpr int burst_size = 4;
+    static constexpr double max_drift = 500e-6; // anything above 500ppm is a clock step, not drift
+    static constexpr std::chrono::milliseconds publish_interval{100};
+
+    std::chrono::seconds sample_interval;
+    std::string rest_host;
+    net::io_context io;
+    net::ssl::context& ssl;
+    RateLimiter* rate_limiter;
+    std::optional<BinanceRestApi> rest_api;
+
+    std::array<TimeSample, max_samples> samples{};
+    size_t sample_head{};
+    size_t sample_size{};
+    double base_local_us{};
+    double base_offset_us{};
+    double drift{};
+
+    std::atomic<int64_t> offset_us{0};
+    std::atomic<int64_t> min_rtt_us{0};
+    std::atomic<int64_t> drift_ppb{0};
+
+    std::mutex mutex;
+    std::condition_variable stop_cv;
+    bool stopped{};
+    std::thread thread;
+private:
+    static int64_t local_us() { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count(); }
+
+    std::optional<TimeSample> request_sample() {
+        try {
+            if (rate_limiter) rate_limiter->acquire(RequestPriority::info, 1);
+            if (!rest_api) {
+                rest_api.emplace(rest_host, "", "", io, ssl);
+                rest_api->set_rate_limiter(rate_limiter);
+            }
+
+            int64_t local_start = local_us();
+            auto result = rest_api->get("/api/v3/time", false);
+            int64_t rtt = std::chrono::duration_cast<std::chrono::microseconds>(rest_api->get_last_round_trip()).count();
+
+            rapidjson::Document doc;
+            doc.Parse(result.second.body().c_str());
+            if (!doc.HasMember("serverTime")) return std::nullopt;
+
+            // server time is truncated to milliseconds, so its middle is the best guess
+            int64_t local_mid = local_start + rtt / 2;
+            int64_t server_us = doc["serverTime"].GetInt64() * 1000 + 500;
+            return TimeSample{local_mid, server_us - local_mid, rtt};
+        }
+        catch (std::exception& e) {
+            std::cout << "time sync: " << e.what() << std::endl;
+            rest_api.reset();
+            return std::nullopt;
+        }
+    }
+
+    void sample_round() {
+        std::optional<TimeSample> best;
+        for (int i = 0; i < burst_size; ++i) {
+            auto s = request_sample();
+            if (s && (!best || s->rtt_us < best->rtt_us)) best = s;
+        }
+        if (!best) return;
+
+        samples[sample_head] = *best;
+        sample_head = (sample_head + 1) % max_samples;
+        sample_size = std::min(sample_size + 1, max_samples);
+        fit();
+    }
+
+    void fit() {
+        int64_t min_rtt = samples[0].rtt_us;
+        for (size_t i = 0; i < sample_size; ++i) min_rtt = std::min(min_rtt, samples[i].rtt_us);
+
+        // rounds that were much slower than the best one are likely queued somewhere, skip them
+        double n = 0, mean_x = 0, mean_y = 0;
+        for (size_t i = 0; i < sample_size; ++i) {
+            if (samples[i].rtt_us > min_rtt * 2) continue;
+            n++;
+            mean_x += static_cast<double>(samples[i].local_us);
+            mean_y += static_cast<double>(samples[i].offset_us);
+        }
+        mean_x /= n;
+        mean_y /= n;
+
+        double sxx = 0, sxy = 0;
+        for (size_t i = 0; i < sample_size; ++i) {
+            if (samples[i].rtt_us > min_rtt * 2) continue;
+            double dx = static_cast<double>(samples[i].local_us) - mean_x;
+            sxx += dx * dx;
+            sxy += dx * (static_cast<double>(samples[i].offset_us) - mean_y);
+        }
+
+        base_local_us = mean_x;
+        base_offset_us = mean_y;
+        drift = sxx > 0 ? std::clamp(sxy / sxx, -max_drift, max_drift) : 0;
+        min_rtt_us.store(min_rtt, std::memory_order_relaxed);
+        drift_ppb.store(static_cast<int64_t>(drift * 1e9), std::memory_order_relaxed);
+    }
+
+    void publish() {
+        if (sample_size == 0) return;
+        double offset = base_offset_us + drift * (static_cast<double>(local_us()) - base_local_us);
+        offset_us.store(static_cast<int64_t>(offset), std::memory_order_relaxed);
+    }
+
+    void run() {
+        auto next_round = std::chrono::steady_clock::now() + sample_interval;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop_cv.wait_for(lock, publish_interval, [this]() { return stopped; })) {
+            if (std::chrono::steady_clock::now() >= next_round) {
+                lock.unlock();
+                sample_round();
+                lock.lock();
+                next_round = std::chrono::steady_clock::now() + sample_interval;
+            }
+            publish();
+        }
+    }
+
+public:
+    TimeSync(std::string rest_host, net::ssl::context& ssl, RateLimiter* rate_limiter = nullptr, std::chrono::seconds sample_interval = std::chrono::seconds(30)) :
+            sample_interval(sample_interval),
+            rest_host(std::move(rest_host)),
+            io(),
+            ssl(ssl),
+            rate_limiter(rate_limiter)
+    {
+        // first estimate is made before any signed request goes out
+        sample_round();
+        publish();
+        thread = std::thread([this]() {
+            Tracer::set_thread_name("time sync");
+            run();
+        });
+    }
+
+    TimeSync(const TimeSync&) = delete;
+    TimeSync& operator=(const TimeSync&) = delete;
+
+    ~TimeSync() { close(); }
+
+    [[maybe_unused]] void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        stop_cv.notify_all();
+        if (thread.joinable()) thread.join();
+    }
+
+    [[maybe_unused]] const std::atomic<int64_t>& get_offset() const { return offset_us; }
+
+    [[maybe_unused]] int64_t now_ms() const { return (local_us() + offset_us.load(std::memory_order_relaxed)) / 1000; }
+
+    // half of it is the best one way latency estimate to exchange
+    [[maybe_unused]] int64_t get_min_rtt_us() const { return min_rtt_us.load(std::memory_order_relaxed); }
+
+    [[maybe_unused]] double get_drift_ppm() const { return static_cast<double>(drift_ppb.load(std::memory_order_relaxed)) / 1000.0; }
+};
+
+
+#endif //ARB_TIME_SYNC_H
@@ -0,0 +1,124 @@
+#ifndef ARB_TIMER_WHEEL_H
+#define ARB_TIMER_WHEEL_H
+
+#include <cinttypes>
+#include <array>
+#include <functional>
+
+// intrusive timer, owned by whoever schedules it. callback is set once, so scheduling never allocates
+struct Timer {
+public:
+    Timer* prev = nullptr;
+    Timer* next = nullptr;
+    uint64_t expires{};
+    bool scheduled{};
+    std::function<void()> callback;
+
+    Timer() = default;
+    explicit Timer(std::function<void()> callback) : callback(std::move(callback)) { }
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+};
+
+// hierarchical timer wheel: 4 levels of 256 slots, every level is 256 times coarser than previous one
+// schedule and cancel are O(1), timers from upper levels cascade down when lower level wraps around
+class TimerWheel {
+public:
+    static constexpr int level_bits = 8;
+    static constexpr int levels = 4;
+    static constexpr uint64_t slots = 1 << level_bits;
+    static constexpr uint64_t slot_mask = slots - 1;
+    static constexpr uint64_t max_delay = (1ull << (level_bits * levels)) - 1;
+private:
+    // slot list heads are sentinels, so link and unlink need no branches on list ends
+    std::array<std::array<Timer, slots>, levels> wheel;
+    uint64_t current_tick{};
+    size_t count{};
+private:
+    static void link(Timer& head, Timer& t) {
+        t.next = head.next;
+        t.prev = &head;
+        head.next->prev = &t;
+        head.next = &t;
+    }
+
+    static void unlink(Timer& t) {
+        t.prev->next = t.next;
+        t.next->prev = t.prev;
+        t.prev = t.next = nullptr;
+    }
+
+    void insert(Timer& t) {
+        uint64_t delta = t.expires - current_tick;
+        int level = 0;
+        while (level < levels - 1 && delta >= (1ull << (level_bits * (level + 1)))) level++;
+        link(wheel[level][(t.expires >> (level_bits * level)) & slot_mask], t);
+    }
+
+    // moves timers of upper level slot to lower levels, called when lower level wraps around
+    void cascade(int level) {
+        Timer& head = wheel[level][(current_tick >> (level_bits * level)) & slot_mask];
+        while (head.next != &head) {
+            Timer& t = *head.next;
+            unlink(t);
+            insert(t);
+        }
+    }
+
+public:
+    TimerWheel() {
+        for (auto& level : wheel)
+            for (auto& head : level) head.prev = head.next = &head;
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // delay is in ticks, 0 fires on next advance
+    void schedule(Timer& t, uint64_t delay) {
+        if (t.scheduled) unlink(t);
+        else count++;
+        t.scheduled = true;
+        t.expires = current_tick + std::max<uint64_t>(1, std::min(delay, max_delay));
+        insert(t);
+    }
+
+    void cancel(Timer& t) {
+        if (!t.scheduled) return;
+        unlink(t);
+        t.scheduled = false;
+        count--;
+    }
+
+    // fires everything that expired up to 'tick'
+    void advance(uint64_t tick) {
+        while (current_tick < tick) {
+            // nothing to fire, so jumping straight to the end is safe
+            if (count == 0) {
+                current_tick = tick;
+                return;
+            }
+
+            current_tick++;
+            for (int level = 1; level < levels; ++level) {
+                if (((current_tick >> (level_bits * (level - 1))) & slot_mask) != 0) break;
+                cascade(level);
+            }
+
+            Timer& head = wheel[0][current_tick & slot_mask];
+            while (head.next != &head) {
+                Timer& t = *head.next;
+                unlink(t);
+                t.scheduled = false;
+                count--;
+                t.callback(); // may schedule timer again
+            }
+        }
+    }
+
+    [[nodiscard]] uint64_t now() const { return current_tick; }
+    [[nodiscard]] size_t size() const { return count; }
+};
+
+
+#endif //ARB_TIMER_WHEEL_H
@@ -0,0 +1,143 @@
+#ifndef ARB_TIMESTAMPED_SOCKET_H
+#define ARB_TIMESTAMPED_SOCKET_H
+
+#include <cinttypes>
+#include <cstring>
+#include <boost/asio.hpp>
+#ifdef __linux__
+#include <ctime>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+#endif
+
+struct RxTimestamp {
+public:
+    int64_t software_ns{}; // kernel receive time, unix time of system clock
+    int64_t hardware_ns{}; // nic clock, only when timestamping is enabled on the nic itself (SIOCSHWTSTAMP)
+};
+
+// tcp socket which reads with recvmsg(), so kernel receive timestamps (SO_TIMESTAMPING) come along with data
+// timestamp belongs to the last segment consumed by a read; tls and websocket layers read ahead,
+// so a frame gets time when its last bytes reached the kernel, or earlier
+// works as plain tcp::socket until enable_rx_timestamps() succeeds
+class TimestampedSocket : public boost::asio::ip::tcp::socket {
+private:
+    using error_code = boost::system::error_code;
+
+    RxTimestamp last_rx;
+    bool timestamps{};
+private:
+#ifdef __linux__
+    // layout of SCM_TIMESTAMPING control message: software, deprecated, raw hardware
+    struct ScmTimestamping {
+    public:
+        timespec ts[3];
+    };
+
+    static int64_t to_ns(const timespec& t) { return static_cast<int64_t>(t.tv_sec) * 1000000000 + t.tv_nsec; }
+#endif
+
+    // non-blocking, would_block when there is nothing to read yet
+    template<class MutableBufferSequence>
+    size_t receive_with_timestamp(const MutableBufferSequence& buffers, error_code& ec) {
+#ifdef __linux__
+        iovec iov[16];
+        size_t count = 0;
+        for (auto it = boost::asio::buffer_sequence_begin(buffers); it != boost::asio::buffer_sequence_end(buffers) && count < 16; ++it) {
+            boost::asio::mutable_buffer b(*it);
+            if (b.size() == 0) continue;
+            iov[count].iov_base = b.data();
+            iov[count].iov_len = b.size();
+            count++;
+        }
+        ec = {};
+        if (count == 0) return 0;
+
+        alignas(cmsghdr) char control[256];
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = ::recvmsg(native_handle(), &msg, MSG_DONTWAIT);
+        if (n < 0) {
+            ec = error_code(errno, boost::system::system_category());
+            return 0;
+        }
+        if (n == 0) {
+            ec = boost::asio::error::eof;
+            return 0;
+        }
+
+        for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SO_TIMESTAMPING) continue;
+            ScmTimestamping ts{};
+            std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            last_rx.software_ns = to_ns(ts.ts[0]);
+            last_rx.hardware_ns = to_ns(ts.ts[2]);
+        }
+        return static_cast<size_t>(n);
+#else
+        (void)buffers;
+        ec = boost::asio::error::operation_not_supported;
+        return 0;
+#endif
+    }
+
+    template<class MutableBufferSequence, class Handler>
+    void wait_and_receive(const MutableBufferSequence& buffers, Handler&& handler) {
+        auto ex = boost::asio::get_associated_executor(handler, get_executor());
+        async_wait(wait_read, boost::asio::bind_executor(ex, [this, buffers, handler = std::forward<Handler>(handler)](error_code ec) mutable {
+            size_t n = 0;
+            if (!ec) n = receive_with_timestamp(buffers, ec);
+            if (ec == boost::asio::error::would_block || ec == boost::asio::error::try_again) return wait_and_receive(buffers, std::move(handler));
+            handler(ec, n);
+        }));
+    }
+
+public:
+    using boost::asio::ip::tcp::socket::socket;
+
+    // must be called on connected socket, false if kernel doesn't support it
+    bool enable_rx_timestamps() {
+#ifdef __linux__
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+        timestamps = setsockopt(native_handle(), SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+#endif
+        return timestamps;
+    }
+
+    template<class MutableBufferSequence>
+    size_t read_some(const MutableBufferSequence& buffers, error_code& ec) {
+        if (!timestamps) return boost::asio::ip::tcp::socket::read_some(buffers, ec);
+        for (;;) {
+            size_t n = receive_with_timestamp(buffers, ec);
+            if (ec != boost::asio::error::would_block && ec != boost::asio::error::try_again) return n;
+            wait(wait_read, ec);
+            if (ec) return 0;
+        }
+    }
+
+    template<class MutableBufferSequence>
+    size_t read_some(const MutableBufferSequence& buffers) {
+        error_code ec;
+        size_t n = read_some(buffers, ec);
+        if (ec) throw boost::system::system_error(ec);
+        return n;
+    }
+
+    template<class MutableBufferSequence, class ReadHandler>
+    auto async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler) {
+        return boost::asio::async_initiate<ReadHandler, void(error_code, size_t)>(
+            [this](auto&& handler, const MutableBufferSequence& buffers) {
+                if (!timestamps) boost::asio::ip::tcp::socket::async_read_some(buffers, std::forward<decltype(handler)>(handler));
+                else wait_and_receive(buffers, std::forward<decltype(handler)>(handler));
+            }, handler, buffers);
+    }
+
+    [[nodiscard]] bool has_rx_timestamps() const { return timestamps; }
+    [[nodiscard]] const RxTimestamp& get_last_rx() const { return last_rx; }
+};
+
+
+#endif //ARB_TIMESTAMPED_SOCKET_H
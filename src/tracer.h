@@ -0,0 +1,192 @@
+#ifndef ARB_TRACER_H
+#define ARB_TRACER_H
+
+#include <cinttypes>
+#include <atomic>
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <functional>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// timeline of hot path spans, dumped as chrome trace json (chrome://tracing, ui.perfetto.dev)
+// every thread writes complete spans into its own ring, oldest spans are overwritten
+// timestamps are tsc ticks, converted to time at dump, so invariant tsc is assumed
+// dump copies rings while recording is paused and waits for spans being written, json is formatted
+// from the copy, on a thread of its own with dump_async
+class Tracer {
+public:
+    static constexpr size_t ring_capacity = 1 << 16; // power of two
+private:
+    struct Event {
+    public:
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    struct Ring {
+    public:
+        std::array<Event, ring_capacity> events;
+        std::atomic<uint64_t> head{0};
+        std::atomic<bool> writing{false}; // set around record(), dump waits for it after pausing
+        uint32_t tid{};
+        std::string thread_name;
+    };
+
+    struct ThreadSpans {
+    public:
+        uint32_t tid;
+        std::string name;
+        std::vector<Event> events;
+    };
+
+    struct Snapshot {
+    public:
+        std::vector<ThreadSpans> threads;
+        double ticks_per_us;
+    };
+
+    static inline std::atomic<bool> enabled{false};
+    static inline std::atomic<bool> paused{false};
+    static inline uint64_t start_ticks{};
+    static inline int64_t start_ns{};
+    // rings outlive their threads, so spans of finished threads are still dumped
+    static inline std::mutex rings_mutex;
+    static inline std::vector<std::shared_ptr<Ring>> rings;
+    static inline std::thread writer; // of last dump_async
+private:
+    static int64_t steady_ns() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+    static Ring& local() {
+        thread_local std::shared_ptr<Ring> ring = []() {
+            auto r = std::make_shared<Ring>();
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            r->tid = static_cast<uint32_t>(rings.size() + 1);
+            r->thread_name = "thread " + std::to_string(r->tid);
+            rings.push_back(r);
+            return r;
+        }();
+        return *ring;
+    }
+
+public:
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(steady_ns());
+#endif
+    }
+
+    static void enable() {
+        start_ticks = now();
+        start_ns = steady_ns();
+        enabled = true;
+    }
+
+    static bool is_enabled() { return enabled.load(std::memory_order_relaxed) && !paused.load(std::memory_order_relaxed); }
+
+    static void set_thread_name(std::string name) {
+        if (!enabled) return;
+        Ring& r = local();
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        r.thread_name = std::move(name);
+    }
+
+    // writing flag and pause are both seq_cst, so either dump sees the flag or record sees the pause
+    static void record(const char* name, uint64_t begin, uint64_t end) {
+        Ring& r = local();
+        r.writing.store(true);
+        if (!paused.load()) {
+            uint64_t h = r.head.load(std::memory_order_relaxed);
+            r.events[h & (ring_capacity - 1)] = Event{name, begin, end};
+            r.head.store(h + 1, std::memory_order_release);
+        }
+        r.writing.store(false, std::memory_order_release);
+    }
+
+private:
+    // spans ended while rings are copied are dropped
+    static Snapshot snapshot() {
+        Snapshot snap;
+        paused.store(true);
+        snap.ticks_per_us = static_cast<double>(now() - start_ticks) / (static_cast<double>(steady_ns() - start_ns) / 1000.0);
+        if (!(snap.ticks_per_us > 0)) snap.ticks_per_us = 1;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            for (auto& r : rings) {
+                while (r->writing.load()) std::this_thread::yield();
+                ThreadSpans& t = snap.threads.emplace_back(ThreadSpans{r->tid, r->thread_name, {}});
+                uint64_t head = r->head.load(std::memory_order_acquire);
+                uint64_t begin = head > ring_capacity ? head - ring_capacity : 0;
+                t.events.reserve(head - begin);
+                for (uint64_t i = begin; i < head; ++i) t.events.push_back(r->events[i & (ring_capacity - 1)]);
+            }
+        }
+        paused.store(false);
+        return snap;
+    }
+
+    static bool write(const Snapshot& snap, const std::string& path) {
+        std::ofstream out(path);
+        out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+        bool first = true;
+        auto separator = [&]() { out << (first ? "\n" : ",\n"); first = false; };
+        for (auto& t : snap.threads) {
+            separator();
+            out << R"({"name": "thread_name", "ph": "M", "pid": 1, "tid": )" << t.tid << R"(, "args": {"name": ")" << t.name << "\"}}";
+            for (const Event& e : t.events) {
+                separator();
+                out << R"({"name": ")" << e.name << R"(", "ph": "X", "pid": 1, "tid": )" << t.tid
+                    << ", \"ts\": " << static_cast<double>(e.begin - start_ticks) / snap.ticks_per_us
+                    << ", \"dur\": " << static_cast<double>(e.end - e.begin) / snap.ticks_per_us << "}";
+            }
+        }
+        out << "\n]}\n";
+        return static_cast<bool>(out);
+    }
+
+public:
+    // waits for a running dump_async first
+    static bool dump(const std::string& path) {
+        if (!enabled) return false;
+        if (writer.joinable()) writer.join();
+        return write(snapshot(), path);
+    }
+
+    // rings are copied on calling thread, file is written on another one, done(bool) is called there
+    // calls from one thread only, next dump waits for this one to finish
+    static void dump_async(const std::string& path, std::function<void(bool)> done) {
+        if (!enabled) return done(false);
+        if (writer.joinable()) writer.join();
+        writer = std::thread([snap = snapshot(), path, done = std::move(done)]() { done(write(snap, path)); });
+    }
+};
+
+// span of enclosing scope, costs one branch when tracing is off
+class TraceScope {
+private:
+    const char* name;
+    uint64_t begin;
+    bool active;
+public:
+    explicit TraceScope(const char* name) : name(name), begin(0), active(Tracer::is_enabled()) {
+        if (active) begin = Tracer::now();
+    }
+
+    ~TraceScope() { if (active) Tracer::record(name, begin, Tracer::now()); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+
+#endif //ARB_TRACER_H
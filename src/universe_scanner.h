@@ -0,0 +1,219 @@
+#ifndef ARB_UNIVERSE_SCANNER_H
+#define ARB_UNIVERSE_SCANNER_H
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <numeric>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include "../include/rapidjson/document.h"
+#include "web.h"
+#include "feed_supervisor.h"
+#include "telemetry.h"
+
+// ranks every symbol of the venue from all market streams, so traded symbols don't have to be picked by hand
+// '!miniTicker@arr' brings last price and 24h quote volume of symbols that changed in the last second,
+// '!bookTicker' brings best bid and ask on every change
+// state is a structure of arrays, after every ticker array all symbols are updated in one pass over
+// vector types: ewma of squared one second returns, ewma of relative spread and the score
+// score is variance over squared round trip cost (spread + two taker fees), so it ranks like volatility / cost,
+// symbols under minimal quote volume score 0
+// candidates are top k by score, a candidate stays until it falls below rank 2k, so the set doesn't churn
+// everything runs on io thread of the scanner
+class UniverseScanner {
+public:
+    struct Candidate {
+    public:
+        std::string symbol;
+        double score;
+        double volatility;   // standard deviation of one second returns
+        double spread;       // relative to mid price
+        double quote_volume; // last 24 hours
+    };
+    using Handler = std::function<void(const std::vector<Candidate>&)>;
+    static constexpr size_t lanes = 4;
+private:
+    typedef double vec __attribute__((vector_size(lanes * sizeof(double))));
+    static constexpr uint32_t skipped = UINT32_MAX; // symbol of other quote asset
+
+    FeedSupervisor feed;
+    std::string quote;
+    double min_quote_volume;
+    double cost;  // two taker fees
+    double alpha; // ewma weight of the newest sample
+    size_t top_k;
+    uint64_t warmup;
+    Handler handler;
+
+    std::unordered_map<std::string, uint32_t> index;
+    std::vector<std::string> names;
+    // sizes are a multiple of lanes, padding lanes keep prices at 1 and volume at 0, so they score 0
+    std::vector<double> last, prev, variance, bid, ask, spread, quote_volume, score;
+    std::vector<uint32_t> order;
+    std::vector<uint8_t> in_band;
+    std::vector<uint32_t> members;
+
+    uint64_t passes{};
+    uint64_t book_tickers{};
+    LatencyHistogram parse_time; // ns, ticker array to updated state
+    LatencyHistogram pass_time;  // ns, vector pass and ranking
+private:
+    // through references, vectors wider than the target isa can't be passed by value without abi warnings
+    static void load(vec& v, const double* p) { std::memcpy(&v, p, sizeof(vec)); }
+    static void store(double* p, const vec& v) { std::memcpy(p, &v, sizeof(vec)); }
+
+    uint32_t slot(const char* symbol, double price) {
+        auto it = index.find(symbol);
+        if (it != index.end()) return it->second;
+        std::string s = symbol;
+        if (s.size() <= quote.size() || s.compare(s.size() - quote.size(), quote.size(), quote) != 0) return index[s] = skipped;
+
+        auto i = static_cast<uint32_t>(names.size());
+        names.push_back(s);
+        if (names.size() > last.size()) {
+            size_t size = last.size() + lanes;
+            for (auto* a : {&last, &prev, &bid, &ask}) a->resize(size, 1);
+            for (auto* a : {&variance, &spread, &quote_volume, &score}) a->resize(size, 0);
+        }
+        last[i] = prev[i] = bid[i] = ask[i] = price;
+        return index[s] = i;
+    }
+
+    void on_message(rapidjson::Document& doc, MessageTimes& times) {
+        if (doc.IsArray()) return on_tickers(doc, times);
+        if (!doc.HasMember("b") || !doc.HasMember("a") || !doc.HasMember("s")) return;
+        // book ticker
+        double b = std::strtod(doc["b"].GetString(), nullptr);
+        double a = std::strtod(doc["a"].GetString(), nullptr);
+        if (b <= 0 || a <= 0) return;
+        uint32_t i = slot(doc["s"].GetString(), (a + b) / 2);
+        if (i == skipped) return;
+        bid[i] = b;
+        ask[i] = a;
+        book_tickers++;
+    }
+
+    // [{"e":"24hrMiniTicker","s":"BTCUSDT","c":"...","q":"...",...}, ...]
+    void on_tickers(const rapidjson::Document& doc, const MessageTimes& times) {
+        for (auto& t : doc.GetArray()) {
+            if (!t.IsObject() || !t.HasMember("s") || !t.HasMember("c") || !t.HasMember("q")) continue;
+            double price = std::strtod(t["c"].GetString(), nullptr);
+            if (price <= 0) continue;
+            uint32_t i = slot(t["s"].GetString(), price);
+            if (i == skipped) continue;
+            last[i] = price;
+            quote_volume[i] = std::strtod(t["q"].GetString(), nullptr);
+        }
+        int64_t parsed = MessageTimes::now();
+        parse_time.record(static_cast<uint64_t>(std::max<int64_t>(0, parsed - times.local_rx_ns)));
+        update();
+        rank();
+        pass_time.record(static_cast<uint64_t>(std::max<int64_t>(0, MessageTimes::now() - parsed)));
+    }
+
+    // symbols missing from the array did not trade, their return is 0
+    void update() {
+        const vec one = vec{} + 1;
+        for (size_t i = 0; i < last.size(); i += lanes) {
+            vec c, p, v, b, a, s, q;
+            load(c, &last[i]);
+            load(p, &prev[i]);
+            load(v, &variance[i]);
+            load(b, &bid[i]);
+            load(a, &ask[i]);
+            load(s, &spread[i]);
+            load(q, &quote_volume[i]);
+            vec r = c / p - one;
+            v += (r * r - v) * alpha;
+            s += ((a - b) / (a + b) * 2 - s) * alpha;
+            vec k = s + cost;
+            vec sc = q >= min_quote_volume ? v / (k * k) : vec{};
+            store(&prev[i], c);
+            store(&variance[i], v);
+            store(&spread[i], s);
+            store(&score[i], sc);
+        }
+    }
+
+    void rank() {
+        passes++;
+        size_t n = names.size();
+        if (passes < warmup || n == 0) return;
+        order.resize(n);
+        std::iota(order.begin(), order.end(), 0);
+        size_t band = std::min(n, 2 * top_k);
+        std::partial_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(band), order.end(), [this](uint32_t x, uint32_t y) { return score[x] > score[y]; });
+        in_band.assign(n, 0);
+        for (size_t i = 0; i < band; ++i) if (score[order[i]] > 0) in_band[order[i]] = 1;
+
+        size_t before = members.size();
+        members.erase(std::remove_if(members.begin(), members.end(), [this](uint32_t m) { return !in_band[m]; }), members.end());
+        bool changed = members.size() != before;
+        for (size_t i = 0; i < std::min(n, top_k) && members.size() < top_k; ++i) {
+            uint32_t m = order[i];
+            if (score[m] <= 0) break;
+            if (std::find(members.begin(), members.end(), m) != members.end()) continue;
+            members.push_back(m);
+            changed = true;
+        }
+        if (changed && handler) handler(get_candidates());
+    }
+
+public:
+    // window is the ewma span in ticker arrays, one arrives every second
+    UniverseScanner(net::io_context& io, net::ssl::context& ssl, const std::string& ws_host, size_t top_k, std::string quote, double min_quote_volume, double taker_fee, int window = 300, Handler handler = {}) :
+            feed(io, ssl, ws_host, "/ws", [this](rapidjson::Document& doc, MessageTimes& times) { on_message(doc, times); }),
+            quote(std::move(quote)),
+            min_quote_volume(min_quote_volume),
+            cost(2 * taker_fee),
+            alpha(2.0 / (window + 1)),
+            top_k(top_k),
+            warmup(static_cast<uint64_t>(std::min(window, 60))),
+            handler(std::move(handler))
+    {
+        if (top_k == 0) throw std::runtime_error("Scanner needs at least one candidate");
+        feed.subscribe("!miniTicker@arr");
+        feed.subscribe("!bookTicker");
+    }
+
+    UniverseScanner(const UniverseScanner&) = delete;
+    UniverseScanner& operator=(const UniverseScanner&) = delete;
+
+    void start() { feed.start(); }
+    void close() { feed.close(); }
+
+    // current candidates, best first
+    [[nodiscard]] std::vector<Candidate> get_candidates() const {
+        std::vector<uint32_t> sorted = members;
+        std::sort(sorted.begin(), sorted.end(), [this](uint32_t x, uint32_t y) { return score[x] > score[y]; });
+        std::vector<Candidate> out;
+        out.reserve(sorted.size());
+        for (uint32_t m : sorted) out.push_back(Candidate{names[m], score[m], std::sqrt(variance[m]), spread[m], quote_volume[m]});
+        return out;
+    }
+
+    void print_stats() const {
+        std::cout << "scanner: " << names.size() << " " << quote << " symbols, " << passes << " ticker arrays, " << book_tickers << " book tickers"
+                  << ", parse p50 " << static_cast<double>(parse_time.percentile(0.5)) / 1000 << " us max " << static_cast<double>(parse_time.get_max()) / 1000 << " us"
+                  << ", pass p50 " << static_cast<double>(pass_time.percentile(0.5)) / 1000 << " us max " << static_cast<double>(pass_time.get_max()) / 1000 << " us"
+                  << (feed.is_connected() ? ", connected" : ", disconnected") << std::endl;
+        if (passes < warmup) std::cout << "\twarming up, " << warmup - passes << " ticker arrays left" << std::endl;
+        for (auto& c : get_candidates())
+            std::cout << "\t" << std::left << std::setw(14) << c.symbol << std::right << std::fixed << std::setprecision(2)
+                      << " volatility: " << std::setw(7) << c.volatility * 10000 << " bps"
+                      << " spread: " << std::setw(7) << c.spread * 10000 << " bps"
+                      << " quote volume: " << std::setw(14) << c.quote_volume << std::endl;
+        std::cout.unsetf(std::ios_base::floatfield);
+    }
+};
+
+
+#endif //ARB_UNIVERSE_SCANNER_H
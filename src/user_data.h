@@ -0,0 +1,355 @@
+#ifndef ARB_USER_DATA_H
+#define ARB_USER_DATA_H
+
+#include <cinttypes>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <optional>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <deque>
+#include <array>
+#include <algorithm>
+#include <functional>
+#include "../include/rapidjson/document.h"
+#include "web.h"
+
+struct Balance {
+public:
+    double free;
+    double locked;
+};
+
+struct OrderFill {
+public:
+    std::string status;
+    double executed;
+    double cum_quote;
+    std::string report; // raw last execution report, for the log
+    bool changed;
+
+    // market orders end in any of these, EXPIRED is used when only part of the order was filled
+    bool is_final() const { return status == "FILLED" || status == "CANCELED" || status == "REJECTED" || status == "EXPIRED"; }
+};
+
+// balances and order fills received from user data stream
+// written from stream thread and read from strategy, so every access is under the lock
+// only orders we track are kept; reports of other orders wait in a short queue, since a fill can come before
+// our ack, and fall off it when they are not ours (other sessions, gui)
+class AccountCache {
+private:
+    static constexpr size_t max_untracked = 64;
+    static constexpr size_t taken_capacity = 64;
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Balance> balances;
+    std::unordered_map<int64_t, OrderFill> orders; // tracked orders with a report
+    std::unordered_map<int64_t, std::string> open_orders; // sent by us and not final yet, order id -> symbol
+    std::deque<std::pair<int64_t, OrderFill>> untracked; // oldest first
+    std::array<int64_t, taken_capacity> taken{}; // ring of orders whose final update was taken, late reports of them are dropped
+    size_t taken_head{};
+private:
+    // stream and rest may report the same order out of order, an older state never replaces a newer one
+    static bool is_newer(const OrderFill* old, const OrderFill& fill) {
+        if (!old) return true;
+        if (old->is_final() || old->executed > fill.executed) return false;
+        return old->status != fill.status || old->executed != fill.executed;
+    }
+
+    // returns true if order state changed
+    bool store(int64_t order_id, OrderFill&& fill) {
+        if (open_orders.count(order_id) == 0) {
+            if (std::find(taken.begin(), taken.end(), order_id) != taken.end()) return false;
+            auto it = std::find_if(untracked.begin(), untracked.end(), [&](auto& o) { return o.first == order_id; });
+            if (it != untracked.end()) {
+                if (!is_newer(&it->second, fill)) return false;
+                it->second = std::move(fill);
+                return true;
+            }
+            if (untracked.size() >= max_untracked) untracked.pop_front();
+            untracked.emplace_back(order_id, std::move(fill));
+            return true;
+        }
+        auto it = orders.find(order_id);
+        if (!is_newer(it == orders.end() ? nullptr : &it->second, fill)) return false;
+        orders[order_id] = std::move(fill);
+        return true;
+    }
+public:
+    AccountCache() { taken.fill(-1); }
+
+    void on_account_position(const rapidjson::Value& doc) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const rapidjson::Value& balances_json = doc["B"];
+        for (rapidjson::SizeType i = 0; i < balances_json.Size(); ++i) {
+            balances[balances_json[i]["a"].GetString()] = Balance{
+                std::stod(balances_json[i]["f"].GetString()),
+                std::stod(balances_json[i]["l"].GetString())
+            };
+        }
+    }
+
+    // returns true if it told something new
+    bool on_execution_report(const rapidjson::Value& doc, std::string&& raw) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return store(doc["i"].GetInt64(), OrderFill{
+            doc["X"].GetString(),
+            std::stod(doc["z"].GetString()),
+            std::stod(doc["Z"].GetString()),
+            std::move(raw),
+            true
+        });
+    }
+
+    // response of GET /api/v3/order, returns true if it told something new
+    bool on_order_query(const rapidjson::Value& doc, std::string&& raw) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return store(doc["orderId"].GetInt64(), OrderFill{
+            doc["status"].GetString(),
+            std::stod(doc["executedQty"].GetString()),
+            std::stod(doc["cummulativeQuoteQty"].GetString()),
+            std::move(raw),
+            true
+        });
+    }
+
+    // orders are tracked from ack until their final update is taken, so they can be queried after reconnect
+    // a report that came before the ack is picked up here
+    void track_order(int64_t order_id, const std::string& symbol) {
+        std::lock_guard<std::mutex> lock(mutex);
+        open_orders[order_id] = symbol;
+        auto it = std::find_if(untracked.begin(), untracked.end(), [&](auto& o) { return o.first == order_id; });
+        if (it == untracked.end()) return;
+        orders[order_id] = std::move(it->second);
+        untracked.erase(it);
+    }
+
+    [[nodiscard]] std::vector<std::pair<int64_t, std::string>> get_open_orders() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {open_orders.begin(), open_orders.end()};
+    }
+
+    [[maybe_unused]] std::optional<Balance> get_balance(const std::string& asset) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = balances.find(asset);
+        if (it == balances.end()) return std::nullopt;
+        return it->second;
+    }
+
+    // returns latest state of order once per change, order is forgotten after its final update
+    [[maybe_unused]] std::optional<OrderFill> take_order_update(int64_t order_id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = orders.find(order_id);
+        if (it == orders.end() || !it->second.changed) return std::nullopt;
+        it->second.changed = false;
+        if (!it->second.is_final()) return it->second;
+        OrderFill fill = std::move(it->second);
+        orders.erase(it);
+        open_orders.erase(order_id);
+        taken[taken_head++ % taken_capacity] = order_id;
+        return fill;
+    }
+};
+
+// listenKey based stream of account events, runs on its own thread
+// lost connection is opened again with a new listen key, then orders still open are read back from rest,
+// so fills sent while disconnected are not missed
+class UserDataStream {
+private:
+    static constexpr std::chrono::minutes keepalive_interval{30}; // listen key expires after 60 minutes without keepalive
+    static constexpr std::chrono::seconds retry_min_delay{1};
+    static constexpr std::chrono::seconds retry_max_delay{60};
+    static constexpr int64_t order_query_weight = 4;
+
+    std::string rest_host;
+    std::string ws_host;
+    std::string api_key;
+    std::string api_secret;
+    std::string listen_key;
+    net::io_context io;
+    net::ssl::context& ssl;
+    net::steady_timer keepalive_timer;
+    net::steady_timer reconnect_timer;
+    net::steady_timer reconcile_timer;
+    std::chrono::seconds reconnect_delay{retry_min_delay};
+    std::chrono::seconds reconcile_delay{retry_min_delay};
+    bool closing{};
+    std::optional<BinanceWebSockets> web_sockets;
+    std::thread thread;
+    AccountCache& cache;
+    RateLimiter* rate_limiter;
+    const std::atomic<int64_t>* clock_offset_us;
+    std::function<void()> on_execution; // called on stream thread after order update is cached
+private:
+    // listen key requests are not signed, only api key header is required
+    // rest connection is made per request because keepalive is sent once in 30 minutes
+    std::string listen_key_request(http::verb method) {
+        if (rate_limiter) rate_limiter->acquire(RequestPriority::info, 2);
+        BinanceRestApi rest_api(rest_host, api_key, "", io, ssl);
+        rest_api.set_rate_limiter(rate_limiter);
+        std::string target = "/api/v3/userDataStream";
+        if (!listen_key.empty()) target += "?listenKey=" + listen_key;
+
+        std::pair<size_t, http::response<http::string_body>> result;
+        if (method == http::verb::post) result = rest_api.post(target, true);
+        else if (method == http::verb::put) result = rest_api.put(target, true);
+        else result = rest_api.del(target, true);
+        rest_api.close();
+
+        rapidjson::Document doc;
+        doc.Parse(result.second.body().c_str());
+        if (doc.HasMember("code")) throw std::runtime_error("listen key request failed: " + std::string(doc["msg"].GetString()));
+        if (doc.HasMember("listenKey")) return doc["listenKey"].GetString();
+        return listen_key;
+    }
+
+    void schedule_keepalive() {
+        keepalive_timer.expires_after(keepalive_interval);
+        keepalive_timer.async_wait([this](beast::error_code ec) {
+            if (ec) return;
+            try { listen_key_request(http::verb::put); }
+            catch (std::exception& e) { std::cout << "user data keepalive: " << e.what() << std::endl; }
+            schedule_keepalive();
+        });
+    }
+
+    void read_next() {
+        web_sockets->async_read([this](beast::error_code ec, size_t) {
+            if (ec) {
+                keepalive_timer.cancel();
+                if (closing || ec == net::error::operation_aborted) return;
+                std::cout << "user data stream: " << ec.message() << ", reconnecting" << std::endl;
+                schedule_reconnect();
+                return;
+            }
+            on_message(web_sockets->read_str_from_buffer());
+            read_next();
+        });
+    }
+
+    // delay doubles after every failed attempt, up to a minute
+    void schedule_reconnect() {
+        reconnect_timer.expires_after(reconnect_delay);
+        reconnect_timer.async_wait([this](beast::error_code ec) {
+            if (ec || closing) return;
+            try {
+                connect();
+                reconnect_delay = retry_min_delay;
+            }
+            catch (std::exception& e) {
+                std::cout << "user data reconnect: " << e.what() << std::endl;
+                reconnect_delay = std::min(reconnect_delay * 2, retry_max_delay);
+                schedule_reconnect();
+                return;
+            }
+            reconcile_orders();
+        });
+    }
+
+    // old listen key may have expired with the connection, so a new one is requested every time
+    void connect() {
+        web_sockets.reset();
+        listen_key.clear();
+        listen_key = listen_key_request(http::verb::post);
+        web_sockets.emplace(ws_host, "/ws/" + listen_key, io, ssl);
+        schedule_keepalive();
+        read_next();
+    }
+
+    // reads state of every order still open from rest, events missed while disconnected are cached like stream ones
+    // stream is already reading, so anything after the query comes from it
+    void reconcile_orders() {
+        auto open_orders = cache.get_open_orders();
+        if (open_orders.empty()) return;
+        bool changed = false;
+        try {
+            BinanceRestApi rest_api(rest_host, api_key, api_secret, io, ssl);
+            rest_api.set_rate_limiter(rate_limiter);
+            rest_api.set_clock_offset(clock_offset_us);
+            for (auto& [order_id, symbol] : open_orders) {
+                if (rate_limiter) rate_limiter->acquire(RequestPriority::info, order_query_weight);
+                auto result = rest_api.get("/api/v3/order", "symbol=" + symbol + "&orderId=" + std::to_string(order_id), true);
+                rapidjson::Document doc;
+                doc.Parse(result.second.body().c_str());
+                if (!doc.HasMember("orderId")) throw std::runtime_error(std::string(doc["msg"].GetString()));
+                changed |= cache.on_order_query(doc, std::move(result.second.body()));
+            }
+            rest_api.close();
+            reconcile_delay = retry_min_delay;
+        }
+        catch (std::exception& e) {
+            std::cout << "user data order query: " << e.what() << std::endl;
+            reconcile_delay = std::min(reconcile_delay * 2, retry_max_delay);
+            reconcile_timer.expires_after(reconcile_delay);
+            reconcile_timer.async_wait([this](beast::error_code ec) { if (!ec && !closing) reconcile_orders(); });
+        }
+        if (changed && on_execution) on_execution();
+    }
+
+    void on_message(std::string&& msg) {
+        rapidjson::Document doc;
+        doc.Parse(msg.c_str());
+        if (!doc.IsObject() || !doc.HasMember("e")) return;
+
+        const char* event = doc["e"].GetString();
+        if (strcmp(event, "executionReport") == 0) {
+            if (cache.on_execution_report(doc, std::move(msg)) && on_execution) on_execution();
+        }
+        else if (strcmp(event, "outboundAccountPosition") == 0) cache.on_account_position(doc);
+        // stream ends after this, closing it makes the read fail and reconnect with a new key
+        else if (strcmp(event, "listenKeyExpired") == 0) web_sockets->async_close([](beast::error_code) { });
+    }
+
+public:
+    // secret signs order queries after reconnect
+    UserDataStream(std::string rest_host, std::string ws_host, std::string key, std::string secret, net::ssl::context& ssl, AccountCache& cache,
+                   RateLimiter* rate_limiter = nullptr, const std::atomic<int64_t>* clock_offset_us = nullptr, std::function<void()> on_execution = {}) :
+            rest_host(std::move(rest_host)),
+            ws_host(std::move(ws_host)),
+            api_key(std::move(key)),
+            api_secret(std::move(secret)),
+            io(),
+            ssl(ssl),
+            keepalive_timer(io),
+            reconnect_timer(io),
+            reconcile_timer(io),
+            cache(cache),
+            rate_limiter(rate_limiter),
+            clock_offset_us(clock_offset_us),
+            on_execution(std::move(on_execution))
+    {
+        connect();
+        thread = std::thread([this]() {
+            Tracer::set_thread_name("user data");
+            io.run();
+        });
+    }
+
+    UserDataStream(const UserDataStream&) = delete;
+    UserDataStream& operator=(const UserDataStream&) = delete;
+
+    ~UserDataStream() {
+        if (thread.joinable()) {
+            io.stop();
+            thread.join();
+        }
+    }
+
+    [[maybe_unused]] void close() {
+        net::post(io, [this]() {
+            closing = true;
+            keepalive_timer.cancel();
+            reconnect_timer.cancel();
+            reconcile_timer.cancel();
+            if (web_sockets) web_sockets->async_close([](beast::error_code) { });
+        });
+        thread.join();
+        io.restart();
+        if (!listen_key.empty()) listen_key_request(http::verb::delete_);
+    }
+};
+
+
+#endif //ARB_USER_DATA_H
@@ -4,6 +4,7 @@
 #include <string>
 #include <utility>
 #include <ostream>
+#include <iostream>
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include <boost/beast/ssl.hpp>
@@ -12,7 +13,13 @@
 #include <boost/asio/ssl.hpp>
 #include <iomanip>
 #include <chrono>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include "../include/rapidjson/document.h"
+#include "rate_limit.h"
+#include "timestamped_socket.h"
+#include "tracer.h"
 
 namespace beast = boost::beast;         // from <boost/beast.hpp>
 namespace http = beast::http;           // from <boost/beast/http.hpp>
@@ -34,55 +41,186 @@ public:
     }
 };
 
+// control frames seen on websocket, updated on io thread and safe to read from any thread
+struct PingStats {
+public:
+    std::atomic<uint64_t> pings_received{0}; // pong to them is sent by beast inside pending read
+    std::atomic<uint64_t> pings_sent{0};
+    std::atomic<uint64_t> pongs_received{0};
+    std::atomic<uint64_t> missed_pongs{0};   // our ping was not answered before the next one
+    std::atomic<int64_t> last_rtt_ns{0};
+    std::atomic<int64_t> rtt_sum_ns{0};
+};
+
 class WebSockets {
 private:
     //websocket::stream<tcp::socket> ws;
-    websocket::stream<beast::ssl_stream<tcp::socket>> ws;
+    websocket::stream<beast::ssl_stream<TimestampedSocket>> ws;
+    tcp::resolver resolver;
+    std::string host;
+    std::string target;
+    std::function<void(beast::error_code)> connect_handler;
+    std::deque<std::string> write_queue;
+    PingStats own_ping_stats;
+    PingStats* ping_stats = &own_ping_stats;
+    bool ping_in_flight{};
+    bool rx_timestamps{};
 public:
     beast::flat_buffer read_buffer;
 
+private:
+    static int64_t now_ns() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+    void set_options() {
+        // set additional data to requests
+        ws.set_option(websocket::stream_base::decorator(
+            [](websocket::request_type& req) { req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING); }
+        ));
+
+        // beast pings idle connection by itself and closes it when there is no answer, so dead connection shows up as read error
+        websocket::stream_base::timeout timeout{};
+        timeout.handshake_timeout = std::chrono::seconds(30);
+        timeout.idle_timeout = std::chrono::seconds(60);
+        timeout.keep_alive_pings = true;
+        ws.set_option(timeout);
+
+        // called from inside pending read, before beast answers server ping with pong
+        ws.control_callback([this](websocket::frame_type kind, beast::string_view payload) {
+            if (kind == websocket::frame_type::ping) {
+                ping_stats->pings_received.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if (kind != websocket::frame_type::pong || payload.empty()) return;
+
+            // payload of our own ping is its send time
+            int64_t sent = std::strtoll(std::string(payload).c_str(), nullptr, 10);
+            if (sent <= 0) return;
+            int64_t rtt = now_ns() - sent;
+            ping_in_flight = false;
+            ping_stats->pongs_received.fetch_add(1, std::memory_order_relaxed);
+            ping_stats->last_rtt_ns.store(rtt, std::memory_order_relaxed);
+            ping_stats->rtt_sum_ns.fetch_add(rtt, std::memory_order_relaxed);
+        });
+    }
+
+    void enable_rx_timestamps() {
+        if (rx_timestamps && !ws.next_layer().next_layer().enable_rx_timestamps())
+            std::cout << "kernel receive timestamps are not supported for " << host << std::endl;
+    }
+
+    void finish_connect(beast::error_code ec) {
+        auto handler = std::move(connect_handler);
+        handler(ec);
+    }
+
+    void write_next() {
+        ws.async_write(net::buffer(write_queue.front()), [this](beast::error_code ec, size_t) {
+            write_queue.pop_front();
+            if (ec) {
+                write_queue.clear();
+                return; // failure will show up in read too
+            }
+            if (!write_queue.empty()) write_next();
+        });
+    }
+
 public:
-    WebSockets(const std::string& host, const std::string& target, net::io_context& io, net::ssl::context& ssl) : ws{io, ssl}, read_buffer() {
+    WebSockets(const std::string& host, const std::string& target, net::io_context& io, net::ssl::context& ssl) : ws{io, ssl}, resolver(io), host(host), target(target), read_buffer() {
         // create endpoint
-        tcp::resolver resolver(io);
         auto const results = resolver.resolve(host, "https");
         net::connect(ws.next_layer().next_layer(), results);
+        enable_rx_timestamps();
 
         // say hello to the server
         ws.next_layer().handshake(net::ssl::stream_base::client);
 
-        // set additional data to requests
-        ws.set_option(websocket::stream_base::decorator(
-            [](websocket::request_type& req) { req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING); }
-        ));
-
+        set_options();
         ws.handshake(host, target);
     }
 
+    // connection is made later with async_connect
+    WebSockets(net::io_context& io, net::ssl::context& ssl) : ws{io, ssl}, resolver(io), read_buffer() { }
+
+    // same steps as in connecting constructor, but without blocking io thread
+    // host may have a port, for example 'stream.binance.com:9443'
+    [[maybe_unused]] void async_connect(std::string new_host, std::string new_target, std::function<void(beast::error_code)> handler) {
+        host = std::move(new_host);
+        target = std::move(new_target);
+        connect_handler = std::move(handler);
+
+        size_t port_pos = host.find(':');
+        std::string name = host.substr(0, port_pos);
+        std::string port = port_pos == std::string::npos ? "https" : host.substr(port_pos + 1);
+        if (!SSL_set_tlsext_host_name(ws.next_layer().native_handle(), name.c_str()))
+            return finish_connect(beast::error_code(static_cast<int>(::ERR_get_error()), net::error::get_ssl_category()));
+
+        resolver.async_resolve(name, port, [this](beast::error_code ec, const tcp::resolver::results_type& results) {
+            if (ec) return finish_connect(ec);
+            net::async_connect(ws.next_layer().next_layer(), results, [this](beast::error_code ec, const tcp::endpoint&) {
+                if (ec) return finish_connect(ec);
+                enable_rx_timestamps();
+                ws.next_layer().async_handshake(net::ssl::stream_base::client, [this](beast::error_code ec) {
+                    if (ec) return finish_connect(ec);
+                    set_options();
+                    ws.async_handshake(host, target, [this](beast::error_code ec) { finish_connect(ec); });
+                });
+            });
+        });
+    }
+
     template<class ConstBufferSequence>
     [[maybe_unused]] void write(ConstBufferSequence const& buffers) { ws.write(buffers); }
 
     [[maybe_unused]] void write(std::string& msg) { ws.write(net::buffer(msg)); }
 
+    // queued write, safe to call while async read is in progress
+    [[maybe_unused]] void send(std::string msg) {
+        write_queue.push_back(std::move(msg));
+        if (write_queue.size() == 1) write_next();
+    }
+
     [[maybe_unused]] size_t read() { read_buffer.clear(); return ws.read(read_buffer); }
 
+    template<class ReadHandler>
+    [[maybe_unused]] void async_read(ReadHandler&& handler) { read_buffer.clear(); ws.async_read(read_buffer, std::forward<ReadHandler>(handler)); }
+
     [[maybe_unused]] std::string read_str_from_buffer() { return beast::buffers_to_string(read_buffer.data()); }
 
     [[maybe_unused]] void pong() { ws.pong(websocket::ping_data()); }
 
+    // measures round trip to server with ping carrying its send time, answer is seen by pending read
+    [[maybe_unused]] void async_ping() {
+        if (ping_in_flight) ping_stats->missed_pongs.fetch_add(1, std::memory_order_relaxed);
+        ping_in_flight = true;
+        ping_stats->pings_sent.fetch_add(1, std::memory_order_relaxed);
+        ws.async_ping(websocket::ping_data(std::to_string(now_ns())), [](beast::error_code) { });
+    }
+
+    // applied on next connect, kernel time of received data is then available after every read
+    [[maybe_unused]] void set_rx_timestamps(bool enable) { rx_timestamps = enable; }
+    [[maybe_unused]] const RxTimestamp& get_rx_timestamp() const { return ws.next_layer().next_layer().get_last_rx(); }
+
+    // stats may be shared between connections that replace each other
+    [[maybe_unused]] void set_ping_stats(PingStats* stats) { ping_stats = stats; }
+    [[maybe_unused]] const PingStats& get_ping_stats() const { return *ping_stats; }
+
+    template<class CloseHandler>
+    [[maybe_unused]] void async_close(CloseHandler&& handler) { ws.async_close(websocket::close_reason(), std::forward<CloseHandler>(handler)); }
+
     [[maybe_unused]] void close() {
 //        ws.next_layer().next_layer().close();
 
         boost::system::error_code ec;
         ws.close(websocket::close_reason(), ec);
         if (ec == boost::asio::ssl::error::stream_truncated) { return; }
-        throw boost::system::system_error{ec};
+        if (ec) throw boost::system::system_error{ec};
     }
 };
 
 class BinanceWebSockets : public WebSockets {
 public:
     BinanceWebSockets(const std::string& base_url, const std::string& target, net::io_context& io, net::ssl::context& ctx) : WebSockets(base_url, target, io, ctx) { }
+    BinanceWebSockets(net::io_context& io, net::ssl::context& ctx) : WebSockets(io, ctx) { }
 
     BinanceResult subscribe(std::string& msg) {
         write(msg);
@@ -99,8 +237,12 @@ private:
     std::string api_key;
     std::string api_secret;
     std::string host;
-    boost::asio::ssl::stream<tcp::socket> stream;
+    boost::asio::ssl::stream<TimestampedSocket> stream;
     bool sign;
+    RateLimiter* rate_limiter = nullptr;
+    const std::atomic<int64_t>* clock_offset_us = nullptr; // exchange time minus local time
+    int recv_window_ms{};
+    std::chrono::nanoseconds last_round_trip{};
 public:
     beast::flat_buffer read_buffer;
 
@@ -115,6 +257,18 @@ public:
         stream.handshake(net::ssl::stream_base::client);
     }
 
+    // limiter only observes response headers, requests are gated by the caller
+    [[maybe_unused]] void set_rate_limiter(RateLimiter* limiter) { rate_limiter = limiter; }
+
+    // signed requests are timestamped with exchange time when offset is set
+    [[maybe_unused]] void set_clock_offset(const std::atomic<int64_t>* offset_us) { clock_offset_us = offset_us; }
+
+    // 0 leaves exchange default (5000ms)
+    [[maybe_unused]] void set_recv_window(int window_ms) { recv_window_ms = window_ms; }
+
+    // time from the start of the write to the end of the read of last request
+    [[maybe_unused]] std::chrono::nanoseconds get_last_round_trip() const { return last_round_trip; }
+
 private:
     template<typename TIter>
     std::string make_hex_string(TIter first, TIter last) {
@@ -144,29 +298,46 @@ private:
     }
 public:
     [[maybe_unused]] void write(http::request<http::string_body> request, bool use_sign = false) {
+        TraceScope trace("rest_write");
         request.set(http::field::host, host);
         request.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
         if (use_sign) request.set("X-MBX-APIKEY", api_key);
         http::write(stream, request);
     }
     [[maybe_unused]] std::pair<size_t, http::response<http::string_body>> read() {
+        TraceScope trace("rest_read");
         http::response<http::string_body> response;
-        return std::make_pair(http::read(stream, read_buffer, response), response);
+        size_t size = http::read(stream, read_buffer, response);
+        if (rate_limiter) rate_limiter->on_response(response);
+        return std::make_pair(size, response);
+    }
+    [[maybe_unused]] std::pair<size_t, http::response<http::string_body>> request(http::verb method, const std::string& target, bool use_sign = false) {
+        auto start = std::chrono::steady_clock::now();
+        write(http::request<http::string_body>{method, target, 11}, use_sign);
+        auto result = read();
+        last_round_trip = std::chrono::steady_clock::now() - start;
+        return result;
     }
     [[maybe_unused]] std::pair<size_t, http::response<http::string_body>> get(const std::string& target, bool use_sign = false) {
-        write(http::request<http::string_body>{http::verb::get, target, 11}, use_sign);
-        return read();
+        return request(http::verb::get, target, use_sign);
     }
     [[maybe_unused]] std::pair<size_t, http::response<http::string_body>> post(const std::string& target, bool use_sign = false) {
-        write(http::request<http::string_body>{http::verb::post, target, 11}, use_sign);
-        return read();
+        return request(http::verb::post, target, use_sign);
+    }
+    [[maybe_unused]] std::pair<size_t, http::response<http::string_body>> put(const std::string& target, bool use_sign = false) {
+        return request(http::verb::put, target, use_sign);
+    }
+    [[maybe_unused]] std::pair<size_t, http::response<http::string_body>> del(const std::string& target, bool use_sign = false) {
+        return request(http::verb::delete_, target, use_sign);
     }
 
     [[maybe_unused]] std::string make_target(std::string target, std::string query, bool use_sign = false) {
         if (use_sign) {
             if (!sign) throw std::runtime_error("Api key or api secret is missing");
-            uint64_t time_ms = std::chrono::system_clock::now().time_since_epoch().count() / 1000 / 1000; // chrono time is in nanoseconds so convert it to milliseconds (unix time)
-            query += "&timestamp=" + std::to_string(time_ms); // time is only required on sign in
+            int64_t time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            if (clock_offset_us) time_us += clock_offset_us->load(std::memory_order_relaxed);
+            if (recv_window_ms > 0) query += "&recvWindow=" + std::to_string(recv_window_ms);
+            query += "&timestamp=" + std::to_string(time_us / 1000); // time is only required on sign in, in milliseconds (unix time)
             query += "&signature=" + sign_in(query);
         }
         if (query.length() > 0) target += '?' + query;
@@ -181,6 +352,10 @@ public:
 
     [[maybe_unused]] std::string read_str_from_buffer() { return beast::buffers_to_string(read_buffer.data()); }
 
+    // kernel time of last received response is then available with get_last_rx_timestamp()
+    [[maybe_unused]] bool enable_rx_timestamps() { return stream.next_layer().enable_rx_timestamps(); }
+    [[maybe_unused]] const RxTimestamp& get_last_rx_timestamp() const { return stream.next_layer().get_last_rx(); }
+
     [[maybe_unused]] void close() {
         boost::system::error_code ec;
         stream.shutdown(ec);